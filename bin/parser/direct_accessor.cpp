@@ -61,8 +61,10 @@
     The forment was how it started, but the latter seems simpler.
 */
 
+#include "include/flats/flat_types.h" // the layout width the generated code must match
 #include "flat.h"
 #include "object_map.h"
+#include <algorithm>
 using namespace std;
 
 // run-time checks for initialization being done can be inserted into code
@@ -70,17 +72,26 @@ using namespace std;
 constexpr bool initialize_check = false;
 constexpr bool default_init = true; // false only for testing
 
-static void print_member(const Field& m, std::ostream& out)
+static void print_member(const Field& m, std::ostream& out, bool packed = false)
 {
-  out << "   " << as_string_cpp(*m.typ) << " " << m.name << ";\n";
+  out << "   ";
+  if (m.align && !packed) // packed layouts have no padding, so "align N" is ignored
+    out << "alignas(" << m.align << ") ";
+  out << as_string_cpp(*m.typ) << " " << m.name << ";\n";
 }
 
-void close_struct(ostream& out, bool /*packed*/)
+void open_struct(ostream& out, bool packed)
+// packed: no padding between fields (see close_struct())
+{
+  if (packed)
+    out << "#pragma pack(push, 1)\n";
+}
+
+void close_struct(ostream& out, bool packed)
 {
-  //   if (packed)
-  //		out << "} __attribute__((packed));\n\n"; // GCC: non-standard
-  //   else
   out << "};\n";
+  if (packed)
+    out << "#pragma pack(pop)\n";
 }
 
 void print_variant(const Flat& flt, std::ostream& out, bool packed = false)
@@ -96,11 +107,12 @@ void print_variant(const Flat& flt, std::ostream& out, bool packed = false)
    };
 */
 {
+  open_struct(out, packed);
   out << "struct " << flt.name << " {\n";
   out << "   char utag = 0;\n   Offset pos = 0;\n   union U {\n";
   for (auto m : flt.fields)
     print_member(m, out);
-  close_struct(out, packed);
+  out << "};\n"; // the alternatives are in the tail, not in the variant
 
   out << "   // constructors:\n";
   out << "   " << flt.name << "() = default;\n";
@@ -141,7 +153,8 @@ void print_variant(const Flat& flt, std::ostream& out, bool packed = false)
             << " arg)\n";
         out << "      :utag{" << count << "}, pos{ allo->allocate(sizeof("
             << as_string_cpp(*m.typ) << ")) }\n";
-        out << "      { reinterpret_cast<" << flt.name
+        out << "      { pos -= reinterpret_cast<Byte*>(this) - allo->flat(); // position relative to this\n";
+        out << "        reinterpret_cast<" << flt.name
             << "::U*>(reinterpret_cast<Byte*>(this)+pos)->" << m.name
             << " = arg; }\n";
     }
@@ -204,7 +217,7 @@ void print_variant(const Flat& flt, std::ostream& out, bool packed = false)
     }
     ++count;
   }
-  out << "};\n";
+  close_struct(out, packed);
 }
 
 void print_struct(const Flat& flt, std::ostream& out, bool packed)
@@ -215,18 +228,49 @@ void print_struct(const Flat& flt, std::ostream& out, bool packed)
     case Type_id::variant:
     case Type_id::enumeration:
     case Type_id::message:
+    case Type_id::view: // see print_view()
       return;
     default:
       break;
   }
   out << "\n\n// struct (memory layout):\n";
-  out << "struct " << flt.name << "{\n";
+  open_struct(out, packed);
+  out << "struct ";
+  if (flt.align && !packed)
+    out << "alignas(" << flt.align << ") ";
+  out << flt.name << "{\n";
   //   out << "   using value_type = void;\n";  // dummy to bypass compiler problem     ???
   out << "   " << flt.name << "(){}\n"; // default constructor
 
-  for (auto m : flt.fields)
-    print_member(m, out);
-  close_struct(out, packed); // just in case we need special treatment of packed structs; otherwise just "};"
+  auto fields = flt.fields;
+  bool heat = std::any_of(fields.begin(), fields.end(), [](const Field& f) { return f.heat != Heat::normal; });
+  if (flt.reorder || flt.profiled || heat) // members in layout order; the deleted ones have no offset and go last
+    std::stable_sort(fields.begin(), fields.end(), [](const Field& a, const Field& b) {
+      auto key = [](const Field& f) {
+        bool mapped = f.typ && (f.status == Status::ordinary || f.status == Status::deprecated);
+        return mapped ? f.offset : std::numeric_limits<int>::max();
+      };
+      return key(a) < key(b);
+    });
+  for (auto m : fields)
+    if (m.typ && m.status != Status::deleted) // a deleted field no longer takes space
+      print_member(m, out, packed);
+  close_struct(out, packed);
+  if (flt.profiled)
+    out << "// " << flt.name << ": fields laid out by access profile\n";
+  else if (flt.reorder)
+    out << "// " << flt.name << ": fields reordered to minimize padding; " << flt.reorder_saving << " bytes saved\n";
+  else if (0 < flt.reorder_saving)
+    out << "// " << flt.name << ": \"flat reorder\" would save " << flt.reorder_saving << " bytes\n";
+
+  if (packed)
+  { // packed accessors use the offsets from the object map
+    out << "static_assert(sizeof(" << flt.name << ") == " << flt.t->size;
+    for (auto& m : flt.fields)
+      if (m.status == Status::ordinary || m.status == Status::deprecated) // the fields in the map
+        out << "\n   && offsetof(" << flt.name << ", " << m.name << ") == " << m.offset;
+    out << ", \"" << flt.name << ": the packed layout differs from the object map\");\n";
+  }
 }
 
 string as_string_accessor(const Type& t, Language = Language::cpp)
@@ -360,6 +404,52 @@ string member_ref(const Field& m)
   return "mbuf->" + m.name;
 }
 
+string as_string_icheck(int i)
+{
+  if (!initialize_check)
+    return "";
+  return "icheck[" + as_string(i) + "]=1; ";
+}
+
+bool is_unaligned(const Flat& flt, const Type& t)
+// a number (or preset) in a packed flat: loaded and stored with memcpy() through an Unaligned<T>
+// the Flats types (Vector, Optional, etc.) are used in place; see "Packed layout" in flat_types.h
+{
+  if (!flt.packed || t.align <= 1)
+    return false;
+  switch (t.id)
+  {
+    case Type_id::flat:
+    case Type_id::variant:
+    case Type_id::string:
+    case Type_id::vector:
+    case Type_id::optional:
+    case Type_id::array:
+    case Type_id::varray:
+      return false;
+    default:
+      return true;
+  }
+}
+
+string as_string_unaligned_accessor(const Field& m, const string& test = "")
+//  Unaligned<std::int32_t> x() { return {reinterpret_cast<Byte*>(mbuf) + 9}; }
+{
+  if (m.status == Status::deleting || m.status == Status::deleted)
+    return "";
+  return "   Unaligned<" + as_string(*m.typ) + "> " + m.name + "() { " + test +
+    " return {reinterpret_cast<Byte*>(mbuf) + " + as_string(m.offset) + "}; }\n";
+}
+
+string as_string_unaligned_constructor(const Field& m)
+//  void x(std::int32_t arg) { x() = arg; }
+{
+  if (m.status == Status::deleting || m.status == Status::deleted)
+    return "";
+  return "   void " + m.name + "(" + as_string_cpp(*m.typ) + " arg) { " +
+    as_string_icheck(m.index) + m.name + "() = arg; }\n";
+}
+
 string as_string_field_accessor(const Field& m, const string& test = "")
 /*
         Examples:
@@ -412,7 +502,7 @@ string as_string_field_accessor(const Field& m, const string& test = "")
 }
 
 static void print_field_accessor(
-  const Flat& /*flt*/, const Field& m, std::ostream& out, const string& test = "")
+  const Flat& flt, const Field& m, std::ostream& out, const string& test = "")
 /*
         Examples:
 
@@ -421,7 +511,10 @@ static void print_field_accessor(
         auto values() { return Span_ref<Pair, Pair_direct>{mbuf->values.begin(), mbuf->values.end(), allo}; }   // flat accessors return accessors
 */
 {
-  out << as_string_field_accessor(m, test);
+  string t = test;
+  if (instrument_accessors) // see print_access_counters()
+    t = "++" + flt.name + "_uses.count[" + to_string(m.index) + "];" + t;
+  out << (is_unaligned(flt, *m.typ) ? as_string_unaligned_accessor(m, t) : as_string_field_accessor(m, t));
 }
 
 static void print_optional_accessor(const Flat& flt, const Field& m, std::ostream& out)
@@ -431,13 +524,6 @@ static void print_optional_accessor(const Flat& flt, const Field& m, std::ostrea
     "expect([&] { return is_present(); }, Error_code::optional_not_present);");
 }
 
-string as_string_icheck(int i)
-{
-  if (!initialize_check)
-    return "";
-  return "icheck[" + as_string(i) + "]=1; ";
-}
-
 string as_string_variant_direct_field_accessor(const Field& m)
 {
   Type& t = *m.typ;
@@ -528,6 +614,46 @@ string as_string_cstring_constructor(const Field& m)
     as_string_icheck(m.index) + "new(&mbuf->" + m.name + ") " +
     as_string(*m.typ) + as_string_allo(m.typ, "(", "allo,", "arg); }\n");
 }
+bool is_bulk_element(const Type& t)
+// elements that can be copied from a contiguous sequence: no tail references to fix up
+{
+  switch (t.id)
+  {
+    case Type_id::string:
+    case Type_id::vector:
+    case Type_id::optional:
+    case Type_id::variant:
+    case Type_id::array:
+    case Type_id::varray:
+      return false;
+    case Type_id::flat:
+      return !needs_allocator(&t);
+    default:
+      return true;
+  }
+}
+
+string as_string_host(const Type& t)
+// the type of t's values on the host: T for Wire<T, order> (see set_wire_order())
+{
+  string s = as_string(t);
+  if (s.rfind("Wire<", 0) == 0)
+    return s.substr(5, s.find(", std::endian::") - 5);
+  return s;
+}
+
+string as_string_span_constructor(const Field& m)
+// bulk initializer from a std::vector, std::array, etc.:
+//  void v(std::span<const int32_t> arg) { new(&mbuf->v) Vector<int32_t>(allo,arg); }
+// for elements in wire order, the span holds host values and the bytes are swapped in bulk
+{
+  if (!is_bulk_element(*m.typ->t))
+    return "";
+  return "   void " + m.name + "(std::span<const " + as_string_host(*m.typ->t) +
+    "> arg) { " + as_string_icheck(m.index) + "new(&mbuf->" + m.name + ") " +
+    as_string(*m.typ) + as_string_allo(m.typ, "(", "allo,", "arg); }\n");
+}
+
 string as_string_varray_constructor(const Field& m)
 // default, extent, list, push
 {
@@ -541,6 +667,8 @@ string as_string_varray_constructor(const Field& m)
     s += as_string_cstring_constructor(m);
   if (m.typ->t->id != Type_id::string)
     s += as_string_string_constructor(m);
+  if (m.typ->t->id != Type_id::char8)
+    s += as_string_span_constructor(m);
   return s;
 }
 
@@ -574,12 +702,12 @@ string as_string_field_constructor(const Field& m)
       if (t.t->id == Type_id::char8) // add additional C-style string initializer
         return as_string_cstring_constructor(m) + as_string_string_constructor(m);
       if (t.t->id == Type_id::flat)
-        return "";
-      break;
+        return as_string_span_constructor(m);
+      return as_string_string_constructor(m) + as_string_span_constructor(m);
     case Type_id::vector:
       if (t.t->id == Type_id::flat)
-        return "";
-      break;
+        return as_string_span_constructor(m);
+      return as_string_string_constructor(m) + as_string_span_constructor(m);
     case Type_id::varray:
       // default, extent, array, push
       return as_string_varray_constructor(m);
@@ -601,9 +729,9 @@ string as_string_field_constructor(const Field& m)
   return as_string_string_constructor(m);
 }
 
-static void print_field_constructor(const Field& m, std::ostream& out)
+static void print_field_constructor(const Flat& flt, const Field& m, std::ostream& out)
 {
-  out << as_string_field_constructor(m);
+  out << (is_unaligned(flt, *m.typ) ? as_string_unaligned_constructor(m) : as_string_field_constructor(m));
 }
 
 string as_string_optional_field_constructor(const Field& m)
@@ -723,6 +851,19 @@ void print_field_default_constructor(const Field& m, std::ostream& out)
   out << as_string_field_default_constructor(m);
 }
 
+string as_string_append_constructor(const Field& m)
+// for Vectors of trivially copyable elements: grow while other fields are being placed
+//  auto v(Reserve, Extent n) { return mbuf->v.reserve(allo, n); }
+//  void v(Append, std::span<const int32_t> arg) { mbuf->v.append(allo, arg); }
+{
+  string et = (m.typ->id == Type_id::string) ? "char" : as_string(*m.typ->t);
+  if (m.typ->id == Type_id::vector && !is_bulk_element(*m.typ->t))
+    return "";
+  return "   auto " + m.name + "(Reserve, Extent n) { return mbuf->" + m.name +
+    ".reserve(allo, n); }\n" + "   void " + m.name + "(Append, std::span<const " +
+    et + "> arg) { mbuf->" + m.name + ".append(allo, arg); }\n";
+}
+
 string as_string_field_size_constructor(const Field& m)
 // for Vectors only:  void v1(Extent x) { new(&mbuf->v1) Vector<int32_t>{ allo, x }; }
 {
@@ -741,7 +882,7 @@ string as_string_field_size_constructor(const Field& m)
         ") " + as_string(t, Language::cpp) + "(allo,arg); }\n" + "   void " +
         m.name + "(Push) { mbuf->" + m.name + ".push(allo); }\n" +
         "   template<class Arg> void " + m.name + "(Push, Arg arg) { mbuf->" +
-        m.name + ".push(allo, arg); }\n";
+        m.name + ".push(allo, arg); }\n" + as_string_append_constructor(m);
     default:
       return "";
   }
@@ -753,13 +894,222 @@ void print_field_size_constructor(const Field& m, std::ostream& out)
   out << as_string_field_size_constructor(m);
 }
 
+bool needs_verification(const Type& t)
+// can a field of type t hold something that refers outside of itself?
+{
+  switch (t.id)
+  {
+    case Type_id::flat:
+    case Type_id::variant:
+    case Type_id::string:
+    case Type_id::vector:
+    case Type_id::optional:
+    case Type_id::array:
+    case Type_id::varray:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void print_verify(const Flat& flt, std::ostream& out)
+// check the fields of a Flat or the selected alternative of a variant received from outside; see Verifier
+{
+  if (flt.id == Type_id::variant)
+  {
+    out << "inline bool verify(const " << flt.name << "& x, Verifier& v)\n{\n";
+    out << "   switch (x.utag) {\n";
+    out << "   case 0: return true;\n";
+    int count = 1;
+    for (auto& m : flt.fields)
+    {
+      string t = as_string_cpp(*m.typ);
+      out << "   case " << count++ << ": { auto p = v.alternative<" << t << ">(&x, x.pos); return p";
+      out << (needs_verification(*m.typ) ? " && v.check(*p)" : " != nullptr") << "; }\n";
+    }
+    out << "   default: return v.fail(Error_code::bad_variant, &x);\n";
+    out << "   }\n";
+  }
+  else
+  {
+    string checks;
+    for (auto& m : flt.fields)
+      if (m.typ && m.status != Status::deleted && needs_verification(*m.typ))
+        checks += (checks.empty() ? "" : "\n      && ") + ("v.check(x." + m.name + ")");
+    if (checks.empty())
+      out << "inline bool verify(const " << flt.name << "&, Verifier&)\n{\n   return true;\n";
+    else
+      out << "inline bool verify(const " << flt.name << "& x, Verifier& v)\n{\n   return " << checks << ";\n";
+  }
+  out << "}\n\n";
+}
+
+void print_verify_message(const Flat& mess, std::ostream& out)
+// verify_M(): check a received buffer before using it as an M
+{
+  Flat& flt = *mess.t->fl;
+  const string& mn = mess.name;
+  const string& fn = flt.name;
+  out << "inline Verify_result verify_" << mn << "(const Byte* buf, int len)\n";
+  out << "// check that buf[0:len) holds a well-formed " << mn << " before trusting any of it\n{\n";
+  out << "   auto m = reinterpret_cast<const " << mn << "*>(buf);\n";
+  out << "   if (len < static_cast<int>(sizeof(" << mn << ") + sizeof(" << fn
+      << "))) return {false, Error_code::bad_message, 0};\n";
+  out << "   if (m->v.v != " << flt.fields.size() << ") return {false, Error_code::bad_version, 0};\n";
+  if (needs_allocator(flt))
+  {
+    out << "   int next = m->alloc.next;\n";
+    out << "   if (next < static_cast<int>(sizeof(" << fn << ")) || m->alloc.max < next || len - static_cast<int>(sizeof("
+        << mn << ")) < next)\n";
+    out << "      return {false, Error_code::bad_message, static_cast<int>(offsetof(" << mn << ", alloc))};\n";
+    out << "   Verifier v{buf, buf + sizeof(" << mn << ") + sizeof(" << fn << "), buf + sizeof(" << mn << ") + next};\n";
+  }
+  else
+    out << "   Verifier v{buf, buf + len, buf + len};\n";
+  out << "   verify(*reinterpret_cast<const " << fn << "*>(buf + sizeof(" << mn << ")), v);\n";
+  out << "   return v.result();\n";
+  out << "}\n\n";
+}
+
+string as_string_unchecked_accessor(const Type& t, const string& name, const string& ref)
+// an accessor without checks for the object ref (e.g., "mbuf->x") of type t
+{
+  switch (t.id)
+  {
+    case Type_id::flat:
+    case Type_id::variant:
+      return "   " + t.name + "_unchecked " + name + "() { return {&" + ref + "}; }\n";
+    case Type_id::string:
+      return "   Unchecked_span<char> " + name + "() { auto& x = " + ref + "; return {x.begin(), x.end()}; }\n";
+    case Type_id::vector:
+    case Type_id::array:
+    case Type_id::varray:
+    {
+      string et = as_string(*t.t);
+      string rt = (t.t->id == Type_id::flat) ? "Unchecked_span_ref<" + et + ", " + et + "_unchecked>"
+                                             : "Unchecked_span<" + et + ">";
+      return "   " + rt + " " + name + "() { auto& x = " + ref + "; return {x.begin(), x.end()}; }\n";
+    }
+    case Type_id::optional:
+    {
+      string et = as_string(*t.t);
+      string rt = (t.t->id == Type_id::flat) ? "Unchecked_optional_ref<" + et + ", " + et + "_unchecked>"
+                                             : "Unchecked_optional<" + et + ">";
+      return "   " + rt + " " + name + "() { return {&" + ref + "}; }\n";
+    }
+    default:
+      return "   " + as_string_accessor(t) + name + "() { return " + ref + "; }\n";
+  }
+}
+
+static void print_unchecked_friends(const Flat& flt, std::ostream& out)
+// only what hands out a flt_unchecked may make one: the verified token of a message of flt,
+// the _unchecked of a flat or variant with a field of flt, and the Unchecked_*_ref for elements and optionals
+{
+  bool by_ref = false;
+  for (const Flat* f : flats)
+    if (f->id == Type_id::message && f->t->fl == &flt)
+      out << "   friend class " << f->name << "_verified;\n";
+    else if (f->id == Type_id::flat || f->id == Type_id::variant)
+    {
+      bool direct = false;
+      for (auto& m : f->fields)
+        if (!m.typ || m.status == Status::deleting || m.status == Status::deleted)
+          continue;
+        else if ((m.typ->id == Type_id::flat || m.typ->id == Type_id::variant) && m.typ->fl == &flt)
+          direct = true;
+        else if (m.typ->t && m.typ->t->id == Type_id::flat && m.typ->t->fl == &flt)
+          by_ref = true; // a vector, array, or optional of flt
+      if (direct)
+        out << "   friend class " << f->name << "_unchecked;\n";
+    }
+  if (by_ref)
+  {
+    out << "   template<class T, class TU> friend struct Unchecked_span_ref;\n";
+    out << "   template<class T, class TU> friend struct Unchecked_optional_ref;\n";
+  }
+}
+
+void print_unchecked(const Flat& flt, std::ostream& out)
+// read accessors without run-time checks; reachable from a verified message only (see M_verified)
+{
+  out << "class " << flt.name << "_unchecked {\n";
+  out << "public:\n";
+  if (flt.id == Type_id::variant)
+  {
+    out << "   auto tag() { return var->utag; }\n";
+    out << "   bool is_present() { return var->utag; }\n";
+    for (auto& m : flt.fields)
+      out << as_string_unchecked_accessor(*m.typ, m.name,
+        "reinterpret_cast<" + flt.name + "::U*>(reinterpret_cast<Byte*>(var) + var->pos)->" + m.name);
+    out << "private:\n";
+    out << "   " << flt.name << "_unchecked(" << flt.name << "* p) :var{p} {}\n";
+    out << "   " << flt.name << "* var;\n";
+  }
+  else
+  {
+    for (auto& m : flt.fields)
+      if (m.status == Status::deleting || m.status == Status::deleted)
+        continue;
+      else if (is_unaligned(flt, *m.typ))
+        out << as_string_unaligned_accessor(m);
+      else
+        out << as_string_unchecked_accessor(*m.typ, m.name, "mbuf->" + m.name);
+    out << "private:\n";
+    out << "   " << flt.name << "_unchecked(" << flt.name << "* p) :mbuf{p} {}\n";
+    out << "   " << flt.name << "* mbuf;\n";
+  }
+  print_unchecked_friends(flt, out);
+  out << "};\n\n";
+}
+
+void print_verified_message(const Flat& mess, std::ostream& out)
+// M_verified: the token that proves that verify_M() succeeded and grants access to the unchecked accessors
+{
+  const string& mn = mess.name;
+  const string& fn = mess.t->fl->name;
+  out << "class " << mn << "_verified {\n";
+  out << "public:\n";
+  out << "   bool ok() const { return res.ok; }\n";
+  out << "   Verify_result result() const { return res; }\n";
+  out << "   " << mn << "* message() const { return res.ok ? m : nullptr; }\n";
+  out << "   " << fn << "_unchecked unchecked() const\n";
+  out << "      { expect<Error_handling::terminating>([&] { return res.ok; }, res.error); return {m->flat()}; }\n";
+  out << "private:\n";
+  out << "   " << mn << "_verified(" << mn << "* p, Verify_result r) :m{p}, res{r} {}\n";
+  out << "   friend " << mn << "_verified verified_" << mn << "(Byte* buf, int len);\n";
+  out << "   " << mn << "* m;\n";
+  out << "   Verify_result res;\n";
+  out << "};\n\n";
+
+  out << "inline " << mn << "_verified verified_" << mn << "(Byte* buf, int len)\n";
+  out << "// verify_" << mn << "(buf, len) once, then read through unchecked() without further checks\n";
+  out << "   { return { reinterpret_cast<" << mn << "*>(buf), verify_" << mn << "(buf, len) }; }\n\n";
+}
+
+void print_upgrades(const Flat& mess, std::ostream& out); // in upgrade_generator.cpp
+
 void print_message(const Flat& mess, std::ostream& out) // generate a Message to hold a Flat
 {
   Flat& flt = *mess.t->fl;
   bool allo = needs_allocator(flt);
 
   std::string mn = mess.name; // + "_message";
-  out << "struct " << mn << " {\n";
+  out << "static_assert(layout_width == " << Flats::layout_width
+      << ", \"" << mn << " was generated for " << Flats::layout_width << "-bit Offsets and Sizes\");\n";
+  if (!wire_order.empty())
+    out << "static_assert(wire_order == std::endian::" << wire_order << ", \"" << mn
+        << " was generated for " << wire_order << "-endian messages: define FLATS_WIRE_ORDER=" << wire_order << "\");\n";
+  int header = sizeof(Flats::Version) + (allo ? sizeof(Flats::Allocator) : 0);
+  if (flt.align && !flt.packed)
+  { // pad the header so that the flat starts on an align-byte boundary of an aligned buffer
+    out << "struct alignas(" << flt.align << ") " << mn << " {\n";
+    int pad = (header + flt.align - 1) / flt.align * flt.align - header;
+    if (pad)
+      out << "   Byte pad[" << pad << "] = {}; // the flat starts on a " << flt.align << "-byte boundary\n";
+  }
+  else
+    out << "struct " << mn << " {\n";
   out << "   using Flat = " << flt.name << ";\n";
   out << "   Version v = { " << flt.fields.size() << "}; // version is generated\n";
   if (allo)
@@ -771,50 +1121,82 @@ void print_message(const Flat& mess, std::ostream& out) // generate a Message to
     out << "      { expect([&] {return static_cast<int>(sizeof(*this)) + alloc.max <=buffer_size; }, Error_code::small_buffer);\n";
     if (default_init)
     {
-      out << "        Byte* pp = reinterpret_cast<Byte*>(flat());\n";
-      out << "        for (int i = 0; i<size_of<Flat>(); ++i) pp[i]=Byte{0};\n"; // is the compiler smart enough to optimize?
-      out << "        Byte* p = tail();\n";
-      out << "        for (int i = 0; i<tail_size; ++i) p[i]=Byte{0};\n"; // is the compiler smart enough to optimize?
+      out << "        kernels::zero_bytes(flat(), sizeof(Flat));\n";
+      out << "        kernels::zero_bytes(tail(), tail_size);\n";
     }
     out << "      }\n";
 
+    // the tail is left as is: Vectors placed with an Extent hold whatever was in the buffer
+    out << "   " << mn << "(Zero_fixed_part, int buffer_size, int tail_size)\n";
+    out << "      :alloc{ size_of<Flat>(),size_of<Flat>() + tail_size }\n";
+    out << "      { expect([&] {return static_cast<int>(sizeof(*this)) + alloc.max <=buffer_size; }, Error_code::small_buffer);\n";
+    if (default_init)
+      out << "        kernels::zero_bytes(flat(), sizeof(Flat));\n";
+    out << "      }\n";
+
+    // a reader needs only the used bytes, so a buffer of wire_size() bytes will do:
     out << "   " << mn << "(Reader, int buffer_size)\n";
-    out << "      { expect([&] {return static_cast<int>(sizeof(*this)) + alloc.max <=buffer_size; }, Error_code::small_buffer); }\n";
+    out << "      { expect([&] {return static_cast<int>(sizeof(*this)) + alloc.next <=buffer_size && alloc.next <= alloc.max; }, Error_code::small_buffer); }\n";
 
     out << "   Byte* tail() { return reinterpret_cast<Byte*>(flat()) + sizeof(Flat); }\n";
     out << "   int current_size() const { return sizeof(*this) + alloc.next; }\n";
     out << "   int current_capacity() const { return alloc.max - alloc.next; }\n";
+    out << "   void shrink_to_fit() { alloc.max = alloc.next; } // no more tail allocation; size() == wire_size()\n";
     out << "   " << flt.name << "_direct direct() { return { flat(), &alloc }; }\n";
+
+    // relocation: a message is position independent, so a memcpy() of what has been built suffices
+    out << "   " << mn << "* grow_into(Byte* bigger, int new_size) const { // accessors to the old buffer are invalidated\n";
+    out << "      int n = current_size();\n";
+    out << "      expect([&] { return n <= new_size; }, Error_code::small_buffer);\n";
+    out << "      kernels::copy_bytes(bigger, this, n);\n";
+    if (default_init)
+      out << "      kernels::zero_bytes(bigger + n, new_size - n);\n";
+    out << "      auto p = reinterpret_cast<" << mn << "*>(bigger);\n";
+    out << "      p->alloc.max = narrow(new_size - sizeof(*this));\n";
+    out << "      return p;\n";
+    out << "   }\n";
   }
   else
   {
     out << "   " << mn << "(int buffer_size, int)\n";
     out << "      { expect([&] {return static_cast<int>(sizeof(*this)) < buffer_size; }, Error_code::small_buffer); }\n";
 
+    out << "   " << mn << "(Zero_fixed_part, int buffer_size, int)\n";
+    out << "      { expect([&] {return static_cast<int>(sizeof(*this)) < buffer_size; }, Error_code::small_buffer); }\n";
+
     out << "   " << mn << "(Reader, int buffer_size)\n";
     out << "      { expect([&] {return static_cast<int>(sizeof(*this)) < buffer_size; }, Error_code::small_buffer); }\n";
 
     out << "   int current_size() const { return sizeof(*this)+sizeof(Flat); }\n";
     out << "   int current_capacity() const { return 0; }\n";
+    out << "   void shrink_to_fit() {}\n";
     out << "   " << flt.name << "_direct direct() { return { flat() }; }\n";
   }
   out << "   " << flt.name << "* flat() { return reinterpret_cast<" << flt.name
       << "*>(reinterpret_cast<Byte*>(this) + sizeof(*this)); }\n";
   out << "   int version() const { return v.v; }\n";
   out << "   int size() const { return current_size()+current_capacity(); }\n";
+  out << "   int wire_size() const { return current_size(); } // bytes to send or copy; unused tail capacity is not included\n";
 
+  // copies hold only the used bytes and have no spare capacity; use grow_into() to copy into a bigger buffer
   out << "   " << mn << "* clone(Byte* p) const {\n"; // returning a reference is accident prone with auto
-  out << "      auto pt = reinterpret_cast<const Byte*>(this);\n";
-  out << "      for (int i = 0; i<size(); ++i) p[i]=pt[i];\n";
-  out << "      return reinterpret_cast<" << mn << "*>(p);\n";
+  out << "      kernels::copy_bytes(p, this, wire_size());\n";
+  out << "      auto q = reinterpret_cast<" << mn << "*>(p);\n";
+  out << "      q->shrink_to_fit();\n";
+  out << "      return q;\n";
+  out << "   }\n";
+  out << "   " << mn << "* clone(Byte* p, Stream) const { // for large messages written into memory read elsewhere\n";
+  out << "      kernels::stream_copy(p, this, wire_size());\n";
+  out << "      auto q = reinterpret_cast<" << mn << "*>(p);\n";
+  out << "      q->shrink_to_fit();\n";
+  out << "      return q;\n";
   out << "   }\n";
 
   out << "      " << mn << "(const " << mn
       << "& arg)\n"; /// sneaky copy constructor; use for placement only
   out << "   {\n";
-  out << "      auto p = reinterpret_cast<Byte*>(this);\n";
-  out << "      auto pt = reinterpret_cast<const Byte*>(&arg);\n";
-  out << "      for (int i = 0; i<size(); ++i) p[i]=pt[i];\n";
+  out << "      kernels::copy_bytes(this, &arg, arg.wire_size());\n";
+  out << "      shrink_to_fit();\n";
   out << "   }\n";
 
   out << "};\n\n";
@@ -822,17 +1204,33 @@ void print_message(const Flat& mess, std::ostream& out) // generate a Message to
   // placement helper functions:
   out << "inline " << mess.name << "* place_" << mess.name
       << "(Byte* buf, int size_of_buffer, int size_of_tail)";
-  out << "   { return new(buf) " << mess.name
+  out << "   { expect_aligned<" << mess.name << ">(buf); return new(buf) " << mess.name
       << " { size_of_buffer,size_of_tail }; }\n\n";
 
+  out << "inline " << mess.name << "* place_" << mess.name
+      << "(Byte* buf, int size_of_buffer, int size_of_tail, Zero_fixed_part z)";
+  out << "   { expect_aligned<" << mess.name << ">(buf); return new(buf) " << mess.name
+      << " { z,size_of_buffer,size_of_tail }; }\n\n";
+
   out << "inline " << mess.name << "* place_" << mess.name
       << "_reader(Byte* buf, int size_of_buffer, int )";
   out << "   { return new(buf) " << mess.name << " { Reader{}, size_of_buffer}; }\n\n";
 
   out << "inline " << mess.name << "* place_" << mess.name
       << "_writer(Byte* buf, int size_of_buffer, int size_of_tail)";
-  out << "   { return new(buf) " << mess.name
+  out << "   { expect_aligned<" << mess.name << ">(buf); return new(buf) " << mess.name
       << " { size_of_buffer,size_of_tail }; }\n\n";
+
+  // pooled buffers (see message_pool.h); a template so that the pool is only needed if used:
+  out << "template<class Pool> " << mess.name << "* acquire_" << mess.name
+      << "(Pool& pool, int size_of_tail = 0)\n";
+  out << "   { int n = sizeof(" << mess.name << ") + sizeof(" << flt.name
+      << ") + size_of_tail; return place_" << mess.name
+      << "_writer(pool.acquire(n, alignof(" << mess.name << ")), n, size_of_tail); }\n\n";
+
+  print_verify_message(mess, out);
+  print_verified_message(mess, out);
+  print_upgrades(mess, out);
 }
 
 void print_variant_direct(const Flat& flt, std::ostream& out)
@@ -869,7 +1267,10 @@ void print_optional_ref(const Flat& flt, std::ostream& out)
   for (auto m : flt.fields)
   {
     print_optional_accessor(flt, m, out);
-    print_optional_field_constructor(m, out);
+    if (is_unaligned(flt, *m.typ))
+      out << as_string_unaligned_constructor(m);
+    else
+      print_optional_field_constructor(m, out);
     //    print_field_empty_constructor(m, out);  // for Optionals only
     //    print_field_size_constructor(m, out);   // for Vectors only
     out << '\n';
@@ -878,6 +1279,144 @@ void print_optional_ref(const Flat& flt, std::ostream& out)
   out << "};\n\n";
 }
 
+static bool is_column_type(const Type& t)
+// a number, character, enumeration, or preset: a batch has a column of its values
+{
+  switch (t.id)
+  {
+    case Type_id::char8:
+    case Type_id::int8:
+    case Type_id::int16:
+    case Type_id::int24:
+    case Type_id::int32:
+    case Type_id::int64:
+    case Type_id::uint8:
+    case Type_id::uint16:
+    case Type_id::uint24:
+    case Type_id::uint32:
+    case Type_id::uint64:
+    case Type_id::float32:
+    case Type_id::float64:
+    case Type_id::enumeration:
+      return true;
+    default:
+      return Type_id::Preset <= t.id;
+  }
+}
+
+static string batch_element(const Type& t)
+// the element type of t's column in a batch; "" if t has none
+{
+  if (is_column_type(t))
+    return as_string_host(t);
+  if (t.id == Type_id::string)
+    return "char";
+  if (t.id == Type_id::vector && is_column_type(*t.t))
+    return as_string_host(*t.t);
+  return "";
+}
+
+void print_batch(const Flat& flt, std::ostream& out)
+/*
+	many flats' fields in columns (structure of arrays), so that a loop over a field is a loop over contiguous values:
+
+	class Trade_batch {
+	public:
+	   void append(const Trade_direct& d) { auto& f = *d.mbuf; cols.price.push_back(f.price); cols.name.append(f.name.begin(), f.name.end()); ++rows; }
+	   std::span<double> price() { return cols.price; }
+	   Ragged_column<char>& name() { return cols.name; }
+	   // ...
+	};
+
+	fields that are neither scalars, Strings, nor Vectors of scalars (e.g., flats and optionals) are not in the batch
+*/
+{
+  const auto& n = flt.name;
+  vector<const Field*> scalars;
+  vector<const Field*> ragged;
+  string left_out;
+  for (auto& m : flt.fields)
+  {
+    if (m.status != Status::ordinary)
+      continue;
+    if (batch_element(*m.typ).empty())
+      left_out += " " + m.name;
+    else
+      (is_column_type(*m.typ) ? scalars : ragged).push_back(&m);
+  }
+
+  out << "class " << n << "_batch {\n";
+  out << "public:\n";
+  out << "   void append(const " << n << "_direct& d) {\n";
+  out << "      auto& f = *d.mbuf;\n";
+  for (auto m : scalars)
+    out << "      cols." << m->name << ".push_back(f." << m->name << ");\n";
+  for (auto m : ragged)
+    out << "      cols." << m->name << ".append(f." << m->name << ".begin(), f." << m->name << ".end());\n";
+  out << "      ++rows;\n";
+  out << "   }\n";
+  out << "   std::size_t size() const { return rows; }\n";
+  out << "   void reserve(std::size_t n) {";
+  for (auto m : scalars)
+    out << " cols." << m->name << ".reserve(n);";
+  for (auto m : ragged)
+    out << " cols." << m->name << ".reserve(n);";
+  out << " }\n";
+  out << "   void clear() {";
+  for (auto m : scalars)
+    out << " cols." << m->name << ".clear();";
+  for (auto m : ragged)
+    out << " cols." << m->name << ".clear();";
+  out << " rows = 0; }\n\n";
+
+  for (auto m : scalars)
+  {
+    auto t = batch_element(*m->typ);
+    out << "   std::span<" << t << "> " << m->name << "() { return cols." << m->name << "; }\n";
+    out << "   std::span<const " << t << "> " << m->name << "() const { return cols." << m->name << "; }\n";
+  }
+  for (auto m : ragged)
+  {
+    auto t = batch_element(*m->typ);
+    out << "   Ragged_column<" << t << ">& " << m->name << "() { return cols." << m->name << "; }\n";
+    out << "   const Ragged_column<" << t << ">& " << m->name << "() const { return cols." << m->name << "; }\n";
+  }
+  if (!left_out.empty())
+    out << "   // not in the batch:" << left_out << "\n";
+
+  out << "private:\n";
+  out << "   std::size_t rows = 0;\n";
+  out << "   struct {\n";
+  for (auto m : scalars)
+    out << "      std::vector<" << batch_element(*m->typ) << "> " << m->name << ";\n";
+  for (auto m : ragged)
+    out << "      Ragged_column<" << batch_element(*m->typ) << "> " << m->name << ";\n";
+  out << "   } cols;\n";
+  out << "};\n\n";
+}
+
+bool instrument_accessors = false;
+
+void print_access_counters(const Flat& flt, std::ostream& out)
+/*
+	per-thread use counts for the fields of flt, dumped at exit (see include/flats/access_profile.h):
+
+	inline constexpr const char* Rec_field_names[] = { "a", "b", };
+	inline constexpr Access_info Rec_access_info{ "Rec", 2, Rec_field_names };
+	inline thread_local Access_counters<2> Rec_uses{ Rec_access_info };
+*/
+{
+  const auto& n = flt.name;
+  auto fields = to_string(flt.fields.size());
+  out << "inline constexpr const char* " << n << "_field_names[] = { ";
+  for (auto& m : flt.fields)
+    out << '"' << m.name << "\", ";
+  out << "};\n";
+  out << "inline constexpr Access_info " << n << "_access_info{ \"" << n << "\", " << fields << ", " << n
+      << "_field_names };\n";
+  out << "inline thread_local Access_counters<" << fields << "> " << n << "_uses{ " << n << "_access_info };\n\n";
+}
+
 void print_direct(const Flat& flt, std::ostream& out, bool packed = false)
 /*
     struct Message_direct {
@@ -892,10 +1431,13 @@ void print_direct(const Flat& flt, std::ostream& out, bool packed = false)
   {
     case Type_id::variant:
       print_variant(flt, out, packed);
+      print_verify(flt, out);
+      print_unchecked(flt, out);
       if (needs_allocator(flt.t))
         print_variant_direct(flt, out);
       return;
     case Type_id::enumeration:
+    case Type_id::view: // see print_view()
       return;
     case Type_id::message:
       print_message(flt, out);
@@ -908,10 +1450,15 @@ void print_direct(const Flat& flt, std::ostream& out, bool packed = false)
 
   const auto& n = flt.name;
 
+  out << "\n";
+  print_verify(flt, out);
+
   out << "\n\n// Flat direct accessors:\n";
   out << "// options: initializer check==" << initialize_check
       << " default initialization==" << default_init << "\n\n";
 
+  if (instrument_accessors)
+    print_access_counters(flt, out);
   out << "   struct " << n << "_message;\n"; // forward declaration
   out << "struct " << n << "_direct {\n";
   out << "   " << n << "* mbuf;\n";
@@ -930,8 +1477,10 @@ void print_direct(const Flat& flt, std::ostream& out, bool packed = false)
 
   for (auto m : flt.fields)
   {
+    if (m.status == Status::deleting || m.status == Status::deleted)
+      continue; // no accessors
     print_field_accessor(flt, m, out);
-    print_field_constructor(m, out);
+    print_field_constructor(flt, m, out);
     if (m.typ->id == Type_id::optional)
     {
       print_field_empty_constructor(m, out);
@@ -943,6 +1492,9 @@ void print_direct(const Flat& flt, std::ostream& out, bool packed = false)
 
   out << "};\n\n";
 
+  print_unchecked(flt, out);
+  print_batch(flt, out);
+
   if (flt.used_as_optional)
     print_optional_ref(flt, out);
 }
\ No newline at end of file
@@ -108,6 +108,13 @@ enum class Status
   deleting
 };
 
+enum class Heat
+{ // how often a field is used: hot fields are placed first, cold ones last
+  normal,
+  hot,
+  cold
+};
+
 struct Predef
 { // pre-defined types
   std::string name;
@@ -130,6 +137,8 @@ struct Field
   int offset = 0;
   int size = 0; // the number of bytes in the fixed part
   Status status = Status::ordinary;
+  Heat heat = Heat::normal;
+  int align = 0; // "align N": place at a multiple of N
 };
 
 struct Bad_variable_part
@@ -162,6 +171,10 @@ struct Flat
   Variable_part var = {};
   bool used_as_optional = false;
   bool packed = false;
+  bool reorder = false; // "flat reorder": lay out fields to minimize padding (see make_object_map())
+  int reorder_saving = 0; // bytes that reordering saves (or would save)
+  bool profiled = false; // laid out by an access profile (see read_access_profile())
+  int align = 0; // "flat align N": N-byte aligned, e.g., on a cache line
   struct Object_map* omap = nullptr;
 
   void push_back(const Field& fld) // add a field at end
@@ -233,6 +246,11 @@ std::ostream& os(); // output
 std::istream& is(); // input
 
 std::vector<Flat*> parse(); // parser
+extern std::vector<Flat*> flats; // what parse() returned: Flats in declaration order
+void set_wire_order(const std::string& order); // "little" or "big"; call before parse()
+extern std::string wire_order; // "" means the host's order
+void read_access_profile(const std::string& file); // field use counts for make_object_map(); call before it
+extern bool instrument_accessors; // _direct accessors count their uses (see include/flats/access_profile.h)
 void print(const Flat& flt); // print flats back out as text
 
 enum Language
@@ -22,6 +22,7 @@
 
 void print_direct(const Flat& flt, std::ostream& out, bool packed = false);
 void print_view(const Flat& flt, std::ostream& out);
+void print_offsets(const Flat& flt, std::ostream& out);
 
 using namespace std;
 
@@ -53,11 +54,11 @@ string get_arg(const string& prompt, int index, int argc, char* argv[])
   return val;
 }
 
-ostream* get_output(const string& name)
+ostream* get_output(const string& name, bool binary = false)
 {
   if (name == "")
     return &cout;
-  if (auto p = new ofstream(name))
+  if (auto p = new ofstream(name, binary ? ios::out | ios::binary : ios::out))
     return p; // leaks file stream unless deleted ???
   error("can't open output file", name);
 }
@@ -85,16 +86,23 @@ enum class Act
   unknown,
   debug,
   cpp_direct,
+  cpp_direct_little,
+  cpp_direct_big,
   cpp_packed,
   cpp_view,
   packed_view,
-  obj_map
+  offsets,
+  obj_map,
+  obj_map_binary
 };
 
 map<string, Act> actions = {
   {"", Act::unknown},          {"debug", Act::debug},
   {"direct", Act::cpp_direct}, {"packed", Act::cpp_packed},
-  {"view", Act::cpp_view},     {"packed_view", Act::packed_view}};
+  {"direct_little", Act::cpp_direct_little}, {"direct_big", Act::cpp_direct_big},
+  {"view", Act::cpp_view},     {"packed_view", Act::packed_view},
+  {"offsets", Act::offsets},   {"obj_map", Act::obj_map},
+  {"obj_map_binary", Act::obj_map_binary}};
 
 Act select_action(const string& name)
 {
@@ -104,11 +112,25 @@ Act select_action(const string& name)
 int main(int argc, char* argv[])
 /*
     zero arguments: command from cin to cout
-    N arguments: command input-file output-file+
+    N arguments: option* command input-file output-file+
+    options:
+        --instrument        _direct accessors count their uses (see include/flats/access_profile.h)
+        --profile=file      lay out the flats in the access profile file with their most used fields first
 */
 try
 {
   vector<string> argument(argv, argv + argc);
+  while (1 < argument.size() && argument[1].starts_with("--"))
+  {
+    const string opt = argument[1];
+    argument.erase(argument.begin() + 1);
+    if (opt == "--instrument")
+      instrument_accessors = true;
+    else if (opt.starts_with("--profile="))
+      read_access_profile(opt.substr(10));
+    else
+      error("parser: unknown option", opt);
+  }
   if (argument.size() == 1)
     error("no arguments to parser");
   int i = 0;
@@ -127,12 +149,17 @@ try
   if (5 < argument.size())
     error("too many output files");
 
+  auto act = select_action(command);
   isp = get_input(ifile); // default: cin
-  osp = get_output(ofile); // default: cout
+  osp = get_output(ofile, act == Act::obj_map_binary); // default: cout
 
-  auto act = select_action(command);
   if (act == Act::unknown)
     error("parser: unknown action");
+  if (act == Act::cpp_direct_little || act == Act::cpp_direct_big)
+  { // direct accessors with numbers in a fixed byte order
+    set_wire_order((act == Act::cpp_direct_little) ? "little" : "big");
+    act = Act::cpp_direct;
+  }
   // cerr << "action: " << static_cast<int>(act) << '\n';
 
   auto flats = parse();
@@ -141,14 +168,16 @@ try
   switch (act)
   { // prefixes
     case Act::cpp_direct:
-      //    case Act::cpp_packed:
+    case Act::cpp_packed:
     case Act::cpp_view:
-      //    case Act::packed_view:
+    case Act::packed_view:
+    case Act::offsets:
       os() << "#include<cstdint>\n";
     default:
       break;
   };
 
+  vector<Object_map> maps; // for obj_map_binary
   for (auto& flt : flats)
   {
     if (flt->id == Type_id::enumeration)
@@ -156,9 +185,9 @@ try
     bool packed = [act] { // overly clever ?
       switch (act)
       {
-          //    case Act::cpp_packed:
-          //    case Act::packed_view:
-          //        return true;
+        case Act::cpp_packed:
+        case Act::packed_view:
+          return true;
         default:
           return false;
       };
@@ -166,6 +195,8 @@ try
 
     Object_map m = make_object_map(*flt, packed); // does all size and position calculations
     flt->omap = &m;
+    if (flt->reorder)
+      cerr << flt->name << ": " << flt->reorder_saving << " bytes saved by reordering fields\n";
     flt->packed = packed;
 
     switch (act)
@@ -178,26 +209,38 @@ try
         break;
       case Act::cpp_direct:
       case Act::cpp_packed:
-        os() << "namespace Flats {\n";
+        os() << "namespace Flats { inline namespace FLATS_POLICY {\n";
         print_struct(*flt, os(), packed);
-        print_direct(*flt, os());
-        os() << "} // namespace Flats\n\n";
+        print_direct(*flt, os(), packed);
+        os() << "} } // namespace Flats\n\n";
         break;
       case Act::cpp_view:
       case Act::packed_view:
-        os() << "namespace Flats {\n";
+        os() << "namespace Flats { inline namespace FLATS_POLICY {\n";
         // assumes that the struct has been output
         print_view(*flt, os());
-        os() << "} // namespace Flats\n";
+        os() << "} } // namespace Flats\n";
+        break;
+      case Act::offsets: // the offset tables of this version, for views generated from another
+        os() << "namespace Flats { inline namespace FLATS_POLICY {\n";
+        print_offsets(*flt, os());
+        os() << "} } // namespace Flats\n";
         break;
       case Act::obj_map:
         print(m, os());
         break;
+      case Act::obj_map_binary:
+        if (flt->id != Type_id::view) // views have no layout of their own
+          maps.push_back(m);
+        break;
       default:
         error("unknown request", static_cast<int>(act));
     }
   }
 
+  if (act == Act::obj_map_binary)
+    write_binary(maps, os());
+
   if (isp != &cin)
     delete isp; // smells
   if (osp != &cout)
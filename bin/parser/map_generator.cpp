@@ -15,9 +15,15 @@
 //---------------------------------------
 // object map generator:
 
+#include "include/flats/flat_types.h" // the sizes of the Flats types
 #include "object_map.h"
+#include <algorithm>
+#include <fstream>
+#include <limits>
 using namespace std;
 
+bool needs_allocator(const Flat& flt); // in direct_accessor.cpp
+
 string get_name(const Type& t)
 {
   switch (t.id)
@@ -53,57 +59,307 @@ string make_type_rep(Type& tp)
     case Type_id::optional: // <T>
       s += "optional<" + make_type_rep(*tp.t) + ">";
       break;
+    case Type_id::array: // T[count]
+      s = make_type_rep(*tp.t);
+      break;
+    case Type_id::varray: // <T, count>
+      return "fixed_vector<" + make_type_rep(*tp.t) + ", " + to_string(tp.count) + ">";
   }
   if (1 < tp.count)
     s += "[" + to_string(tp.count) + "]";
   return s;
 }
 
-Object_map make_object_map(Flat& flt, bool packed)
+static int round_up(int n, int a)
+{
+  return (n + a - 1) / a * a;
+}
+
+static void layout(Type& t)
+// size and alignment of t as the C++ compiler sees it
+// the parser's estimates don't know the sizes of flats: they are known only once a flat's map has been made
+{
+  switch (t.id)
+  {
+    case Type_id::string:
+    case Type_id::vector:
+      t.size = sizeof(Flats::Vector<char>);
+      t.align = alignof(Flats::Vector<char>);
+      break;
+    case Type_id::optional: // bool filled; T val;
+      layout(*t.t);
+      t.align = t.t->align;
+      t.size = round_up(round_up(1, t.align) + t.t->size, t.align);
+      break;
+    case Type_id::array: // T val[count];
+      layout(*t.t);
+      t.align = t.t->align;
+      t.size = t.count * t.t->size;
+      break;
+    case Type_id::varray: // Size used; T val[count];
+      layout(*t.t);
+      t.align = std::max(static_cast<int>(alignof(Flats::Size)), t.t->align);
+      t.size = round_up(round_up(sizeof(Flats::Size), t.t->align) + t.count * t.t->size, t.align);
+      break;
+    default: // fundamental types and presets have fixed sizes; flats and variants were done by make_object_map()
+      break;
+  }
+}
+
+static bool is_mapped(const Field& fld)
+// fields being deleted or deprecated have no place in the layout
+{
+  switch (fld.status)
+  {
+    case Status::deleting:
+    case Status::deprecating:
+    case Status::deleted:
+      return false;
+    default:
+      return true;
+  }
+}
+
+static int alignment(const Field& fld, bool packed)
+{
+  return packed ? 1 : std::max(fld.typ->align, fld.align);
+}
+
+static int place(const vector<Field*>& order, bool packed, bool variant)
+// give the fields their offsets in order; return the end of the last
 {
-  int count = 0; // number of object_map entries
-  int index = 0; // field index
   int position = 0; // byte count
+  for (Field* fld : order)
+  {
+    //cerr << "field: " << fld->name << (packed?" packed ":" aligned ") << "pos =" << position << " sz=" << fld->size << " al=" << alignment(*fld, packed) << '\n';
+    position = round_up(position, alignment(*fld, packed));
+    fld->offset = position;
+    if (!variant) // the alternatives of a variant are in the tail
+      position += fld->size;
+  }
+  return position;
+}
 
+static bool refers_to_tail(const Type& t)
+// the field is just a header for data in the tail
+{
+  switch (t.id)
+  {
+    case Type_id::string:
+    case Type_id::vector:
+    case Type_id::variant:
+      return true;
+    case Type_id::optional:
+    case Type_id::array:
+      return refers_to_tail(*t.t);
+    default:
+      return false;
+  }
+}
+
+static int group(const Field& fld)
+// the order of the groups of fields in a flat with hot or cold fields
+{
+  switch (fld.heat)
+  {
+    case Heat::hot:
+      return 0;
+    case Heat::cold:
+      return 3;
+    default:
+      return refers_to_tail(*fld.typ) ? 2 : 1; // reading the header implies a trip to the tail
+  }
+}
+
+static map<string, map<string, uint64_t>> access_profile; // flat -> field -> uses
+
+void read_access_profile(const string& file)
+// lines of "flat field count", as written by include/flats/access_profile.h; counts of repeated lines are added
+{
+  ifstream in{file};
+  if (!in)
+    error("can't open access profile", file);
+  string flat;
+  string field;
+  uint64_t count;
+  while (in >> flat >> field >> count)
+    access_profile[flat][field] += count;
+  if (!in.eof())
+    error("bad access profile", file);
+}
+
+static map<const Field*, int> profile_groups(vector<Field*> order, const map<string, uint64_t>& uses)
+/*
+	the most used fields first, in groups that fit in a cache line (a field larger than a cache line is a group by itself);
+	the unused fields form the last group
+*/
+{
+  auto count = [&](const Field* f) {
+    auto p = uses.find(f->name);
+    return (p == uses.end()) ? 0 : p->second;
+  };
+  std::stable_sort(order.begin(), order.end(), [&](Field* a, Field* b) { return count(b) < count(a); });
+
+  map<const Field*, int> groups;
+  int g = 0;
+  int bytes = 0; // in group g
+  for (Field* fld : order)
+  {
+    if (count(fld) == 0)
+    {
+      groups[fld] = numeric_limits<int>::max();
+      continue;
+    }
+    if (bytes && cache_line < bytes + fld->size)
+    {
+      ++g;
+      bytes = 0;
+    }
+    bytes += fld->size;
+    groups[fld] = g;
+  }
+  return groups;
+}
+
+Object_map make_object_map(Flat& flt, bool packed)
+/*
+	also sets the size and alignment of flt, so flats must be mapped before they are used as fields
+
+	Fields are laid out in declaration order, except
+		in a flat with hot or cold fields: the hot ones come first, so that they share the first cache line(s),
+		then the other fields that are used in place, then the headers of Strings, Vectors, etc., then the cold ones
+		in a "flat reorder": within each of those groups, fields are placed in order of decreasing alignment,
+		which leaves no padding between them
+		in a flat in the access profile (see read_access_profile()): the most used fields come first,
+		in groups that fit in a cache line, each group in order of decreasing alignment; the profile overrides hot and cold
+	In every case, the map lists the fields in declaration order (by index) with their offsets.
+*/
+{
   Object_map m;
   m.head.name = flt.name;
   m.head.version = flt.no_of_fields();
+  m.head.type_id = flt.id;
+  if (flt.id == Type_id::view)
+    return m; // a view has no layout of its own; flt.t is the flat it views
 
+  bool variant = flt.id == Type_id::variant;
+  vector<Field*> order; // physical order
+  int align = 1; // the largest alignment of a field
+  bool heat = false; // any hot or cold fields?
   for (Field& fld : flt.fields)
-  {
-    switch (fld.status)
+    if (is_mapped(fld))
     {
-      case Status::deleting:
-      case Status::deprecating:
-      case Status::deleted:
-        break;
-      default:
-      {
-        Type* tp = fld.typ;
-        //cerr << "field: " << fld.name << (packed?" packed ":" aligned ") << "pos =" << position << " sz=" << tp->size << " al=" << tp->align << ' ' << position % tp->align << '\n';
-        //cerr<< "type: " << tp->name << '\n';
-        fld.size = tp->size;
-        fld.offset = position;
-        m.fields.push_back(Field_entry{
-          index, position, tp->size, tp->id, tp->count, 0, fld.name,
-          make_type_rep(*tp)});
-        ++count;
-        if (!packed && (position % tp->align))
-          position += (tp->align - position % tp->align);
-        if (flt.id != Type_id::variant)
-        {
-          //cerr << "field: " << fld.name << " pos=" << position << '\n';
-          position += tp->size;
-        }
-      }
+      layout(*fld.typ);
+      fld.size = fld.typ->size;
+      align = std::max(align, alignment(fld, packed));
+      heat = heat || fld.heat != Heat::normal;
+      order.push_back(&fld);
     }
+  if (!packed)
+    align = std::max(align, flt.align);
+
+  auto prof = access_profile.find(flt.name);
+  flt.profiled = flt.id == Type_id::flat && prof != access_profile.end();
+  map<const Field*, int> groups;
+  if (flt.profiled)
+  {
+    if (heat)
+      cerr << flt.name << ": the access profile overrides the hot and cold fields\n";
+    groups = profile_groups(order, prof->second);
+  }
+  auto rank = [&](const Field* fld) { return flt.profiled ? groups[fld] : heat ? group(*fld) : 0; };
+
+  auto sorted = [&](bool by_alignment) {
+    auto v = order;
+    std::stable_sort(v.begin(), v.end(), [&](Field* a, Field* b) {
+      int ra = rank(a);
+      int rb = rank(b);
+      if (ra != rb)
+        return ra < rb;
+      return by_alignment && alignment(*b, packed) < alignment(*a, packed);
+    });
+    return v;
+  };
+  if (!packed && !variant)
+  { // the saving is reported even if the flat is not reordered
+    int reordered = round_up(std::max(place(sorted(true), packed, variant), 1), align);
+    int declared = round_up(std::max(place(sorted(false), packed, variant), 1), align);
+    flt.reorder_saving = declared - reordered;
+  }
+  order = sorted((flt.reorder || flt.profiled) && !variant);
+  int position = place(order, packed, variant);
+
+  int hot_end = 0;
+  for (Field* fld : order)
+    if (fld->heat == Heat::hot)
+      hot_end = std::max(hot_end, fld->offset + fld->size);
+  if (cache_line < hot_end && !flt.profiled)
+    cerr << flt.name << ": the hot fields take " << hot_end << " bytes; more than one cache line\n";
+
+  int index = 0; // field index
+  for (Field& fld : flt.fields)
+  {
+    if (is_mapped(fld))
+      m.fields.push_back(Field_entry{
+        index, fld.offset, fld.size, fld.typ->id, fld.typ->count, 0, fld.name, make_type_rep(*fld.typ)});
     ++index;
   }
-  m.head.number_of_fields = count;
+  m.head.number_of_fields = static_cast<int>(m.fields.size());
 
-  if (!packed)
-    position += (alignof(Flat) - position % alignof(Flat));
+  if (flt.id == Type_id::message)
+  { // flt.t is the message's flat: a message's map has that as its one field, after the header (Version, Allocator)
+    const Flat& f = *flt.t->fl;
+    int header = sizeof(Flats::Version) + (needs_allocator(f) ? sizeof(Flats::Allocator) : 0);
+    if (f.align && !packed)
+      header = round_up(header, f.align);
+    m.fields.push_back(Field_entry{0, header, flt.t->size, Type_id::flat, 1, 0, "flat", f.name});
+    m.head.number_of_fields = 1;
+    m.head.size = header + flt.t->size;
+    m.head.align = flt.t->align;
+    return m;
+  }
+  if (flt.id == Type_id::variant)
+  { // char utag; Offset pos; the alternatives are in the tail
+    position = 1 + sizeof(Flats::Offset);
+    align = alignof(Flats::Offset);
+  }
+  if (packed)
+    align = 1;
+  position = round_up(std::max(position, 1), align); // a C++ object has at least one byte
   flt.t->size = position;
+  flt.t->align = align;
+  m.head.size = position;
+  m.head.align = align;
   flt.var = {position, position};
   return m;
 }
+
+Object_map make_object_map(const Flat& flt, int version, bool packed)
+/*
+	the layout of an earlier version of flt, for converting its messages (see upgrade_generator.cpp)
+
+	Version N of a flat is its first N entries: a "delete x" or "deprecate x" entry has an index of its own,
+	so a field deleted by an entry at or after N was still in the layout of version N.
+	The layout is computed with the options of this run (reorder, hot/cold, profile);
+	flt and its type are left as they were.
+*/
+{
+  Flat old = flt;
+  old.fields.resize(std::min(version, flt.no_of_fields()));
+  for (Field& fld : old.fields)
+  {
+    if (!fld.typ || fld.status != Status::deleted)
+      continue;
+    bool gone = false; // deleted by an entry of this version?
+    for (const Field& e : old.fields)
+      gone = gone || (!e.typ && e.name == fld.name && fld.index < e.index);
+    if (!gone)
+      fld.status = Status::ordinary;
+  }
+  int size = flt.t->size; // make_object_map() sets them
+  int align = flt.t->align;
+  Object_map m = make_object_map(old, packed);
+  flt.t->size = size;
+  flt.t->align = align;
+  return m;
+}
@@ -15,6 +15,8 @@
 #pragma once
 #include "flat.h"
 
+constexpr int cache_line = 64; // bytes; for laying out and reporting hot fields
+
 struct Field_entry
 {
   int index; // ordinal
@@ -32,7 +34,9 @@ struct Flat_header
   std::string name;
   int number_of_fields; // version-deleted
   int version;
-  // int size;	???
+  int size = 0; // sizeof the flat
+  int align = 0;
+  Type_id type_id = Type_id::flat; // flat, variant, message, ...
 };
 
 struct Object_map
@@ -42,5 +46,17 @@ struct Object_map
 };
 
 Object_map make_object_map(Flat& flt, bool packed = false);
+Object_map make_object_map(const Flat& flt, int version, bool packed); // an earlier version of flt
+
+struct Message_layout
+{ // of a message of a flat, as written with some version of the flat
+  int header; // bytes before the flat: padding, Version, and Allocator
+  int version_at; // offset of the Version
+  bool allocator; // the version had a tail
+  int size; // of the flat
+};
+
+Message_layout message_layout(const Flat& flt, int version); // in upgrade_generator.cpp
 
-void print(Object_map& m, std::ostream&); // print as text
\ No newline at end of file
+void print(Object_map& m, std::ostream&); // print as text
+void write_binary(std::vector<Object_map>& maps, std::ostream&); // see include/flats/object_map_file.h
\ No newline at end of file
@@ -15,6 +15,7 @@
 //---------------------------------------
 // object map printer (textural form):
 #include "object_map.h"
+#include <algorithm>
 using namespace std;
 
 void print(Flat_header& h, std::ostream& out)
@@ -36,7 +37,13 @@ void print(Object_map& m, std::ostream& out)
     out << ',' << fld.count; // elements of an array
     out << ",\"" << fld.name << "\"";
     out << ", \"" << fld.type_name << "\"";
-    out << "}\n";
+    out << "}";
+    int first = fld.offset / cache_line; // assuming that the flat starts a cache line
+    int last = (fld.offset + std::max(fld.size, 1) - 1) / cache_line;
+    out << " // cache line " << first;
+    if (first != last)
+      out << '-' << last;
+    out << '\n';
   }
 
   out << "} // object map\n\n";
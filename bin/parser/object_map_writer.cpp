@@ -0,0 +1,70 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+ 
+       http://www.apache.org/licenses/LICENSE-2.0.
+ 
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+//---------------------------------------
+// object map writer (binary form): a frame of Obj_map messages, one per flat, in order of name
+// (see include/flats/object_map_file.h)
+
+#include "include/flats/object_map_file.h"
+#include "object_map.h"
+#include <algorithm>
+using namespace std;
+
+static int tail_size(const Object_map& m)
+// bytes of tail needed for m's Obj_map, allowing for alignment
+{
+  int n = static_cast<int>(m.head.name.size()) + 8;
+  for (auto& f : m.fields)
+    n += sizeof(Flats::Field_map) + f.name.size() + f.type_name.size() + 16;
+  return n;
+}
+
+void write_binary(vector<Object_map>& maps, ostream& out)
+{
+  std::sort(maps.begin(), maps.end(), [](const Object_map& a, const Object_map& b) { return a.head.name < b.head.name; });
+
+  int size = sizeof(Flats::Frame_header);
+  for (auto& m : maps)
+    size += Flats::frame_align + sizeof(Flats::Obj_map) + sizeof(Flats::Flat_map) + tail_size(m)
+      + sizeof(Flats::Frame_entry);
+  vector<Flats::Byte> buf(size);
+  Flats::Frame_builder b{buf.data(), size};
+
+  for (auto& m : maps)
+  {
+    auto d = b.place<Flats::Obj_map>(Flats::object_map_type, tail_size(m))->direct();
+    d.fields(Flats::Extent{static_cast<int>(m.fields.size())}); // first, to keep the Field_maps aligned
+    d.name(m.head.name);
+    d.version(m.head.version);
+    d.bytes(m.head.size);
+    d.align(m.head.align);
+    d.type_id(static_cast<int16_t>(m.head.type_id));
+    auto fields = d.fields();
+    for (int i = 0; i != static_cast<int>(m.fields.size()); ++i)
+    {
+      auto& f = m.fields[i];
+      auto fd = fields[i];
+      fd.index(f.index);
+      fd.offset(f.offset);
+      fd.bytes(f.size);
+      fd.count(f.count);
+      fd.type_id(static_cast<int16_t>(f.type_id));
+      fd.name(f.name);
+      fd.type_name(f.type_name);
+    }
+  }
+
+  int n = b.finish();
+  out.write(reinterpret_cast<const char*>(buf.data()), n);
+}
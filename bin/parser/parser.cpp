@@ -22,6 +22,8 @@
 	named types:
 		v : variant { i:int32, f:float32 } 
 		f : flat { m : int32 mv : v }
+		g : flat reorder { c : char x : int64 }	// fields placed to minimize padding
+		h : flat align 64 { hot p : float64 cold note : string align 64 seq : int64 }	// cache-line layout
 		e : enum { a:2 b:7 c d }
 		vv : view of f
         v2 : view of f {m}
@@ -38,6 +40,7 @@
 
 #include "include/flats/flat_types.h" // needed to know the sizes of Flats types
 #include "flat.h"
+#include <algorithm>
 
 // application types. They don't really belong here, but we need their sizes for the object map
 #include "application_types.h" 
@@ -378,8 +381,8 @@ Type* get_type(Type_id id)
       t->size = ((t->id == Type_id::char8) ? sizeof(Flats::Size) : t->t->align) +
         t->t->size;
       break;
-    case Type_id::varray:
-      t->size = ((t->id == Type_id::char8) ? sizeof(Flats::Size) : t->t->align) +
+    case Type_id::varray: // Size used; then the elements
+      t->size = std::max(static_cast<int>(sizeof(Flats::Size)), t->t->align) +
         t->count * t->t->size;
       break;
     default:; // suppress spurious warning
@@ -410,30 +413,78 @@ Field modify_field(Flat* flt, Status s)
   return fld;
 }
 
+int get_alignment()
+// number: a power of two
+{
+  int n = get_number();
+  if (n < 1 || 4096 < n || (n & (n - 1)))
+    error("alignment must be a power of two no larger than 4096:", to_string(n));
+  return n;
+}
+
 Field get_field(Flat* flt, Type_id id)
+// attributes name ':' type
+// attributes (flats only):
+//	hot, cold: placed in the first cache lines or after everything else (see make_object_map())
+//	align N: placed at a multiple of N, e.g., align 64 to start a new cache line
 {
   string n = get_name();
   if (n == "deprecate")
     return modify_field(flt, Status::deprecated); // make a deprecating field
   if (n == "delete")
     return modify_field(flt, Status::deleted); // make a deleting field
+  Heat heat = Heat::normal;
+  int align = 0;
+  while (!is_char(':'))
+  { // n wasn't a member name (a member may be called "hot")
+    put_back();
+    if (flt->id != Type_id::flat)
+      error("colon missing after member name", n);
+    if (n == "hot")
+      heat = Heat::hot;
+    else if (n == "cold")
+      heat = Heat::cold;
+    else if (n == "align")
+      align = get_alignment();
+    else
+      error("colon missing after member name", n);
+    n = get_name();
+  }
   if (flt->find(n))
     error("member defined twice", n);
-  if (!is_char(':'))
-    error("colon missing after member name", n);
   auto t = get_type(id);
   if (!t)
     error("internal error: very weird ", n);
   eat_terminator();
-  return {n, t};
+  Field fld{n, t};
+  fld.heat = heat;
+  fld.align = align;
+  return fld;
 }
 
-owner<Flat*> get_flat(const string& n, Type_id id) // 'flat' name already seen:'{' members '}'
+void get_flat_options(Flat* flt)
+// options between "flat" and '{':
+//	reorder: place the fields to minimize padding, rather than in declaration order
+//	align N: align the flat (and so its size) to N bytes, e.g., align 64 for a cache line
+{
+  while (!is_char('{'))
+  {
+    put_back();
+    string s = get_name();
+    if (s == "reorder" && flt->id == Type_id::flat)
+      flt->reorder = true;
+    else if (s == "align" && flt->id == Type_id::flat)
+      flt->align = get_alignment();
+    else
+      error("unknown option", s, "(or '{' expected)");
+  }
+}
+
+owner<Flat*> get_flat(const string& n, Type_id id) // 'flat' name already seen: options '{' members '}'
 {
   //	cerr << "get_flat(): " << n << '\n';
   owner<Flat*> flt = new Flat{id, n};
-  if (!is_char('{'))
-    error("'{' expected");
+  get_flat_options(flt);
   while (!is_char('}'))
   {
     put_back();
@@ -474,14 +525,36 @@ Flat* get_view(const string& n)
       flt->push_back(Field{n, fld->typ});
     }
   }
-  else
-  { // complete view
+  else // complete view
     put_back();
-    flt->t = t;
-  }
+  flt->t = t; // the flat viewed
   return flt;
 }
 
+std::string wire_order; // "", "little", or "big"; see set_wire_order()
+
+void set_wire_order(const std::string& order)
+// store numeric fields as Wire<T, std::endian::order> rather than T
+{
+  wire_order = order;
+  for (auto& [name, t] : symbol_table)
+    switch (t->id)
+    {
+      case Type_id::int16:
+      case Type_id::int32:
+      case Type_id::int64:
+      case Type_id::uint16:
+      case Type_id::uint32:
+      case Type_id::uint64:
+      case Type_id::float32:
+      case Type_id::float64:
+        t->cpp_native_name = "Wire<" + t->cpp_native_name + ", std::endian::" + order + ">";
+        break;
+      default: // single bytes need no ordering; int24 and presets are not numbers we know how to swap
+        break;
+    }
+}
+
 void check_for_undefined()
 {
   int nerr = 0;
@@ -577,7 +650,7 @@ vector<Flat*> parse()
     t->id = flt->id;
     t->fl = flt; // transfer ownership
 
-    if (s != "message")
+    if (s != "message" && s != "view") // for those, t is the underlying flat
       flt->t = t;
 
     flats.push_back(flt); // for order
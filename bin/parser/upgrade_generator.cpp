@@ -0,0 +1,281 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0.
+
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+/*
+ upgrades: converting a message written with an earlier version of its flat to the current version
+
+ The layouts of both versions are known here, so the conversion is planned now:
+ the bytes of the fields that are in both versions are copied in runs of fields that kept their relative positions,
+ the tail is copied as it is, and the Offsets of the headers in the fixed part (Strings, Vectors, variants)
+ are adjusted by how much their header and the tail moved. Nothing is re-placed.
+*/
+
+#include "include/flats/flat_types.h" // the sizes of the Flats types
+#include "object_map.h"
+#include <algorithm>
+using namespace std;
+
+bool needs_allocator(const Type* t); // in direct_accessor.cpp
+
+static int round_up(int n, int a)
+{
+  return (n + a - 1) / a * a;
+}
+
+struct Tail_ref
+{ // a header in the fixed part that refers to the tail
+  int offset; // in the flat
+  bool variant; // else a String or Vector
+};
+
+static void tail_refs(const Type& t, int offset, vector<Tail_ref>& refs)
+// the headers in a t at offset; a nested flat has its current layout
+{
+  switch (t.id)
+  {
+    case Type_id::string:
+    case Type_id::vector:
+      refs.push_back({offset, false});
+      break;
+    case Type_id::variant:
+      refs.push_back({offset, true});
+      break;
+    case Type_id::optional: // bool filled; T val;
+      tail_refs(*t.t, offset + round_up(1, t.t->align), refs);
+      break;
+    case Type_id::array: // T val[count];
+      for (int i = 0; i != t.count; ++i)
+        tail_refs(*t.t, offset + i * t.t->size, refs);
+      break;
+    case Type_id::varray: // Size used; T val[count];
+      for (int i = 0; i != t.count; ++i)
+        tail_refs(*t.t, offset + round_up(sizeof(Flats::Size), t.t->align) + i * t.t->size, refs);
+      break;
+    case Type_id::flat:
+      for (const Field& fld : t.fl->fields)
+        if (fld.typ && (fld.status == Status::ordinary || fld.status == Status::deprecated))
+          tail_refs(*fld.typ, offset + fld.offset, refs);
+      break;
+    default:
+      break;
+  }
+}
+
+static int header_size(const Flat& flt, bool allo)
+// sizeof(M) for a message of flt: Version, Allocator if the flat has a tail, and the padding of an aligned flat
+{
+  int n = sizeof(Flats::Version) + (allo ? sizeof(Flats::Allocator) : 0);
+  if (flt.align && !flt.packed)
+    n = round_up(n, flt.align);
+  return n;
+}
+
+static bool old_allocator(const Flat& flt, int version)
+{
+  for (int i = 0; i != version; ++i)
+    if (needs_allocator(flt.fields[i].typ))
+      return true;
+  return false;
+}
+
+static int version_offset(const Flat& flt, bool allo)
+// Version v follows the padding
+{
+  return header_size(flt, allo) - sizeof(Flats::Version) - (allo ? sizeof(Flats::Allocator) : 0);
+}
+
+Message_layout message_layout(const Flat& flt, int version)
+// where the flat of a message written with this version of flt is, and how big it is
+{
+  bool allo = old_allocator(flt, version);
+  return {header_size(flt, allo), version_offset(flt, allo), allo, make_object_map(flt, version, flt.packed).head.size};
+}
+
+struct Run
+{ // bytes copied from the old flat to the new
+  int to;
+  int from;
+  int bytes;
+  string names;
+};
+
+static void print_upgrade(const Flat& mess, int version, std::ostream& out)
+/*
+	inline R* upgrade_R_v2_to_v5(const Byte* from, int len, Byte* to, int size)
+	{
+		... check the old header ...
+		auto m = place_R(to, size, room, Zero_fixed_part{});	// the fields new in v5 are zero
+		kernels::copy_bytes(q + 0, p + 0, 16);	// a, b
+		kernels::copy_bytes(m->tail(), p + 24, tail);
+		rebase_vector(q + 16, 8);	// s
+		...
+	}
+*/
+{
+  const Flat& flt = *mess.t->fl;
+  const string& mn = mess.name;
+  const string& fn = flt.name;
+  int now = flt.no_of_fields();
+  Object_map old = make_object_map(flt, version, flt.packed);
+  bool old_allo = old_allocator(flt, version);
+  bool allo = needs_allocator(mess.t);
+  int old_header = header_size(flt, old_allo);
+  int old_size = old.head.size;
+  int new_size = flt.t->size;
+
+  auto old_offset = [&](int index) {
+    for (auto& e : old.fields)
+      if (e.index == index)
+        return e.offset;
+    return -1;
+  };
+
+  vector<const Field*> fields; // in the new layout, in physical order
+  for (const Field& fld : flt.fields)
+    if (fld.typ && (fld.status == Status::ordinary || fld.status == Status::deprecated))
+      fields.push_back(&fld);
+  std::stable_sort(fields.begin(), fields.end(), [](const Field* a, const Field* b) { return a->offset < b->offset; });
+
+  vector<Run> runs; // fields that kept their place relative to their neighbors are copied together
+  vector<string> added;
+  for (const Field* fld : fields)
+  {
+    int from = old_offset(fld->index);
+    if (from < 0)
+    { // a field new since version: breaks a run, but its bytes are already zero
+      added.push_back(fld->name);
+      runs.push_back({});
+    }
+    else if (!runs.empty() && runs.back().bytes && from - runs.back().from == fld->offset - runs.back().to)
+    { // the gap, if any, is padding in the new layout
+      runs.back().bytes = fld->offset + fld->size - runs.back().to;
+      runs.back().names += ", " + fld->name;
+    }
+    else
+      runs.push_back({fld->offset, from, fld->size, fld->name});
+  }
+
+  out << "inline " << mn << "* upgrade_" << mn << "_v" << version << "_to_v" << now
+      << "(const Byte* from, int len, Byte* to, int size)\n";
+  out << "// the version " << version << " " << mn << " in from[0:len) as a version " << now << " " << mn
+      << " in to[0:size), the rest of which is tail capacity\n";
+  if (!added.empty())
+  {
+    out << "// zero: ";
+    for (auto& n : added)
+      out << n << (&n == &added.back() ? "\n" : ", ");
+  }
+  out << "{\n";
+  out << "   auto v = reinterpret_cast<const Version*>(from + " << version_offset(flt, old_allo) << ");\n";
+  if (old_allo)
+  {
+    out << "   auto a = reinterpret_cast<const Allocator*>(from + " << version_offset(flt, old_allo) + sizeof(Flats::Version)
+        << ");\n";
+    out << "   bool ok = " << old_header << " <= len && v->v == " << version << " && " << old_size
+        << " <= a->next && a->next <= a->max && a->next <= len - " << old_header << ";\n";
+    out << "   int tail = ok ? a->next - " << old_size << " : 0;\n";
+  }
+  else
+  {
+    out << "   bool ok = " << old_header + old_size << " <= len && v->v == " << version << ";\n";
+    out << "   int tail = 0;\n";
+  }
+  out << "   expect([&] { return ok; }, Error_code::bad_message);\n";
+  out << "   int room = size - static_cast<int>(sizeof(" << mn << ") + sizeof(" << fn << "));\n";
+  out << "   expect([&] { return " << (allo ? "tail" : "0") << " <= room; }, Error_code::small_buffer);\n";
+  out << "   if (!ok || room < " << (allo ? "tail" : "0") << ") return nullptr; // the error policy didn't stop us\n";
+  out << "   auto m = place_" << mn << "(to, size, room, Zero_fixed_part{});\n";
+  out << "   const Byte* p = from + " << old_header << "; // the old flat\n";
+  out << "   Byte* q = reinterpret_cast<Byte*>(m->flat());\n";
+  for (auto& r : runs)
+    if (r.bytes)
+      out << "   kernels::copy_bytes(q + " << r.to << ", p + " << r.from << ", " << r.bytes << "); // " << r.names << "\n";
+  if (allo)
+  {
+    out << "   kernels::copy_bytes(m->tail(), p + " << old_size << ", tail);\n";
+    out << "   m->alloc.next = narrow(sizeof(" << fn << ") + tail);\n";
+  }
+
+  // a header moved by (new offset - old offset); the elements it refers to moved by (new_size - old_size)
+  for (const Field* fld : fields)
+  {
+    int from = old_offset(fld->index);
+    int delta = (new_size - old_size) - (fld->offset - from);
+    if (from < 0 || delta == 0)
+      continue;
+    vector<Tail_ref> refs;
+    tail_refs(*fld->typ, fld->offset, refs);
+    for (auto& r : refs)
+      if (r.variant)
+        out << "   rebase_variant(q + " << r.offset << ", " << delta << (flt.packed ? ", true" : "") << "); // "
+            << fld->name << "\n";
+      else
+        out << "   rebase_vector(q + " << r.offset << ", " << delta << "); // " << fld->name << "\n";
+  }
+  out << "   return m;\n";
+  out << "}\n\n";
+}
+
+void print_upgrades(const Flat& mess, std::ostream& out)
+/*
+	for a message of a flat with N entries (fields, deletions, and deprecations):
+		upgrade_M_vK_to_vN() for each earlier version K
+		upgrade_M(), which looks at the version in the message, if it is in the same place in every version
+
+	The tail is copied as is: the tail data of fields deleted since is still there, but unused.
+*/
+{
+  const Flat& flt = *mess.t->fl;
+  int now = flt.no_of_fields();
+  if (now < 2)
+    return;
+  out << "// upgrades from earlier versions of " << flt.name << ":\n";
+  for (int version = 1; version != now; ++version)
+    print_upgrade(mess, version, out);
+
+  bool allo = needs_allocator(mess.t);
+  int at = version_offset(flt, allo);
+  for (int version = 1; version != now; ++version)
+    if (version_offset(flt, old_allocator(flt, version)) != at)
+      return; // an aligned flat that gained or lost its tail: the caller must know the version
+
+  const string& mn = mess.name;
+  out << "inline " << mn << "* upgrade_" << mn << "(const Byte* from, int len, Byte* to, int size)\n";
+  out << "// the " << mn << " of any version in from[0:len) as a version " << now << " " << mn << " in to[0:size)\n";
+  out << "{\n";
+  out << "   expect([&] { return " << at + sizeof(Flats::Version) << " <= len; }, Error_code::bad_message);\n";
+  out << "   switch (reinterpret_cast<const Version*>(from + " << at << ")->v) {\n";
+  for (int version = 1; version != now; ++version)
+    out << "   case " << version << ": return upgrade_" << mn << "_v" << version << "_to_v" << now
+        << "(from, len, to, size);\n";
+  out << "   case " << now << ": {\n";
+  out << "      auto m = reinterpret_cast<const " << mn << "*>(from);\n";
+  out << "      bool ok = static_cast<int>(sizeof(" << mn << ") + sizeof(" << flt.name
+      << ")) <= len && m->wire_size() <= len;\n";
+  out << "      expect([&] { return ok; }, Error_code::bad_message);\n";
+  out << "      if (!ok) return nullptr;\n";
+  if (allo)
+    out << "      return m->grow_into(to, size);\n";
+  else
+  {
+    out << "      expect([&] { return m->wire_size() <= size; }, Error_code::small_buffer);\n";
+    out << "      return m->clone(to);\n";
+  }
+  out << "   }\n";
+  out << "   default:\n";
+  out << "      expect([] { return false; }, Error_code::bad_version);\n";
+  out << "      return nullptr;\n";
+  out << "   }\n";
+  out << "}\n\n";
+}
@@ -13,59 +13,208 @@
 */
 
 /*
- view accessors
+ view accessors: fields found through an offset table for the writer's version (see include/flats/view_offsets.h)
 */
 
 #include "flat.h"
+#include "include/flats/flat_types.h" // the sizes of the Flats types
+#include "object_map.h"
+#include <algorithm>
 using namespace std;
 
-static void
-  print_view_field_accessor(const Field& m, const Flat& flt, std::ostream& out, int count)
+bool is_unaligned(const Flat& flt, const Type& t); // in direct_accessor.cpp
+
+static bool is_viewed(const Field& m)
+// deleted fields have no accessors
+{
+  return m.status != Status::deleting && m.status != Status::deleted;
+}
+
+static void print_view_field_accessor(const Field& m, const Flat& flt, std::ostream& out)
 /*
-	int& x() { return reinterpret_cast<Mess*>(buff+m[m.index]); }
+	bool has_x() const { return 0 <= offs[1]; }
+	std::int32_t& x() { expect([&] { return has_x(); }, Error_code::absent_field); return *reinterpret_cast<std::int32_t*>(buff + offs[1]); }
+
+	a nested flat is read with this version's layout
 */
 {
-  if (m.status == Status::deleting)
-    return;
-  if (m.status == Status::deleted)
+  auto i = to_string(m.index);
+  out << "   bool has_" << m.name << "() const { return 0 <= offs[" << i << "]; }\n";
+  out << "   ";
+  if (is_unaligned(flt, *m.typ))
+    out << "Unaligned<" << as_string_cpp(*m.typ) << "> ";
+  else
+    out << as_string_cpp(*m.typ) << "& ";
+  out << m.name << "() { expect([&] { return has_" << m.name << "(); }, Error_code::absent_field); ";
+  if (is_unaligned(flt, *m.typ))
+    out << "return {buff + offs[" << i << "]}; }\n";
+  else
+    out << "return *reinterpret_cast<" << as_string_cpp(*m.typ) << "*>(buff + offs[" << i << "]); }\n";
+}
+
+static void print_offsets(const Flat& flt, std::ostream& out, bool versioned)
+/*
+	the offset table of this version of flt, registered at startup, by field index (-1: not in this version):
+
+	inline const int* const Mess_offsets_v3 = Offset_registry::get().add("Mess", 3, { 0, -1, 8, });
+*/
+{
+  out << "inline const int* const " << flt.name << "_offsets_v" << flt.no_of_fields()
+      << " = Offset_registry::get().add(\"" << flt.name << "\", " << flt.no_of_fields() << ", { ";
+  for (auto& m : flt.fields)
+  {
+    bool mapped = m.status == Status::ordinary || m.status == Status::deprecated;
+    out << (mapped ? m.offset : -1) << ", ";
+  }
+  out << "});\n";
+  if (!versioned)
     return;
-  if (m.typ->count > 1)
+
+  out << "inline const int* " << flt.name << "_offsets(int version)\n";
+  out << "// the offset table of a version of " << flt.name << "; the last one used is remembered\n";
+  out << "{\n";
+  out << "   thread_local int last_version = " << flt.no_of_fields() << ";\n";
+  out << "   thread_local const int* last = " << flt.name << "_offsets_v" << flt.no_of_fields() << ";\n";
+  out << "   if (version != last_version) {\n";
+  out << "      auto p = Offset_registry::get().find(\"" << flt.name << "\", version, " << flt.no_of_fields() << ");\n";
+  out << "      expect([&] { return p != nullptr; }, Error_code::bad_version);\n";
+  out << "      if (!p) return last; // the error policy didn't stop us\n";
+  out << "      last_version = version;\n";
+  out << "      last = p;\n";
+  out << "   }\n";
+  out << "   return last;\n";
+  out << "}\n\n";
+}
+
+static void print_view_struct(const string& name, const Flat& flt, const vector<const Field*>& fields, std::ostream& out)
+{
+  const auto& n = flt.name;
+  out << "struct " << name << " {\n";
+  out << "   const int* offs; // by field index\n";
+  out << "   Byte* buff; // the flat\n";
+  out << "   " << name << "(const int* o, Byte* p) :offs{ o }, buff{ p } {}\n";
+  out << "   " << name << "(int version, Byte* p) :offs{ " << n << "_offsets(version) }, buff{ p } {}\n\n";
+  for (auto m : fields)
+    print_view_field_accessor(*m, flt, out);
+  out << "};\n\n";
+}
+
+static void print_message_view(const Flat& mess, std::ostream& out)
+/*
+	inline Rec_view view_R(Byte* buf, int len)
+	{
+		... find the version: the Version is in the same place in every version, or where the version says it is ...
+		switch (version) {	// where the flat starts depends on the version: an Allocator once the flat has a tail, padding
+		case 2: ok = 4 + 16 <= len; flat = 4; break;
+		case 4: ok = 12 + 24 <= len && ...Allocator's next fits in len...; flat = 12; break;
+		}
+		...
+	}
+*/
+{
+  const Flat& flt = *mess.t->fl;
+  const string& mn = mess.name;
+  const string& fn = flt.name;
+  int now = flt.no_of_fields();
+  vector<Message_layout> layouts(now + 1);
+  for (int version = 1; version <= now; ++version)
+    layouts[version] = message_layout(flt, version);
+
+  out << "inline " << fn << "_view view_" << mn << "(Byte* buf, int len)\n";
+  out << "// the flat of the " << mn << " in buf[0:len), read with the version in its header and the layout of that version\n";
+  out << "{\n";
+  out << "   static const int none[] = { ";
+  for (int i = 0; i != now; ++i)
+    out << "-1, ";
+  out << "}; // a message that doesn't check out has no fields\n";
+  out << "   int version = 0;\n";
+  for (int first = 1; first <= now;)
+  { // versions [first:last] have their Version in the same place
+    int at = layouts[first].version_at;
+    int last = first;
+    while (last < now && layouts[last + 1].version_at == at)
+      ++last;
+    out << "   if (" << (first == 1 ? "" : "version == 0 && ") << at + sizeof(Flats::Version) << " <= len) {\n";
+    out << "      int v = reinterpret_cast<const Version*>(buf + " << at << ")->v;\n";
+    out << "      if (" << first << " <= v && v <= " << last << ") version = v;\n";
+    out << "   }\n";
+    first = last + 1;
+  }
+  out << "   bool ok = false;\n";
+  out << "   int flat = 0;\n";
+  out << "   switch (version) {\n";
+  for (int version = 1; version <= now; ++version)
   {
-    out << "using XXX" << count << " = ";
-    print(*m.typ, Language::cpp, out);
-    out << ";\n  XXX" << count;
+    auto& l = layouts[version];
+    out << "   case " << version << ": ok = " << l.header + l.size << " <= len";
+    if (l.allocator)
+    {
+      out << " && [&] { auto a = reinterpret_cast<const Allocator*>(buf + " << l.version_at + sizeof(Flats::Version)
+          << "); return " << l.size << " <= a->next && a->next <= len - " << l.header << "; }()";
+    }
+    out << "; flat = " << l.header << "; break;\n";
   }
-  else
-    print(*m.typ, Language::cpp, out);
-  out << "& ";
-  out << m.name;
-  out << "() { return *reinterpret_cast<" << flt.name << "*>(buff+m[" << m.index
-      << "]); }\n";
+  out << "   }\n";
+  out << "   expect([&] { return ok; }, Error_code::bad_message);\n";
+  out << "   if (!ok) return { none, buf }; // the error policy didn't stop us\n";
+  out << "   return { version, buf + flat };\n";
+  out << "}\n\n";
+}
+
+void print_offsets(const Flat& flt, std::ostream& out)
+// just the offset table: for reading messages written with this version of a schema
+{
+  if (flt.id == Type_id::flat)
+    print_offsets(flt, out, false);
 }
 
 void print_view(const Flat& flt, std::ostream& out)
 /*
-	struct Mess_view_accessor {
-		const Offsets m;	// an offset is an array of ints
-		Byte* p;
-		Mess_view_accessor(const Offsets& mm, Byte* pp) :m{ mm }, p{ pp } {};
+	struct Mess_view {
+		const int* offs;	// by field index
+		Byte* buff;
+		Mess_view(const int* o, Byte* p) :offs{ o }, buff{ p } {}
+		Mess_view(int version, Byte* p) :offs{ Mess_offsets(version) }, buff{ p } {}
 
-		int& x() { *reinterpret_cast<int*>(p + m[0]); }
-		string& s() { *reinterpret_cast<String*>(p + m[1]); }
+		bool has_x() const { return 0 <= offs[0]; }
+		std::int32_t& x() { ... return *reinterpret_cast<std::int32_t*>(buff + offs[0]); }
 	};
+
+	a view type ("v : view of Mess { x }") gets a struct with accessors to its fields only;
+	a message gets view_M(), which views its flat with the version in its header
 */
 {
-  if (flt.id == Type_id::variant)
-    return;
-  if (flt.id == Type_id::enumeration)
-    return;
-  out << "\n\n// view accessors:\n";
-  out << " struct " << flt.name << "_view {\n";
-  out << "   const Offsets mm;\n";
-  out << "   Byte* buff;\n";
-  out << flt.name << "_view(const Offsets& mm, const Byte* pp) :m{mm}, buff{ pp } {}\n";
-  int count = 0;
-  for (auto m : flt.fields)
-    print_view_field_accessor(m, flt, out, count++);
-  out << "};\n\n";
+  switch (flt.id)
+  {
+    case Type_id::flat:
+    {
+      out << "\n\n// view accessors:\n";
+      print_offsets(flt, out, true);
+      vector<const Field*> fields;
+      for (auto& m : flt.fields)
+        if (is_viewed(m))
+          fields.push_back(&m);
+      print_view_struct(flt.name + "_view", flt, fields, out);
+      return;
+    }
+    case Type_id::view:
+    { // the fields named in the view, or all of them
+      const Flat& base = *flt.t->fl;
+      vector<const Field*> fields;
+      auto named = [&](const Field& m) {
+        return flt.fields.empty()
+          || std::any_of(flt.fields.begin(), flt.fields.end(), [&](const Field& v) { return v.name == m.name; });
+      };
+      for (auto& m : base.fields)
+        if (is_viewed(m) && named(m))
+          fields.push_back(&m);
+      print_view_struct(flt.name, base, fields, out);
+      return;
+    }
+    case Type_id::message:
+      print_message_view(flt, out);
+      return;
+    default:
+      return;
+  }
 }
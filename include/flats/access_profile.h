@@ -0,0 +1,105 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0.
+
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+#pragma once
+/*
+	Access profiles: how often the fields of each flat are used, for laying out flats
+	so that the most used fields share the leading cache lines
+
+	Generate with "flats --instrument direct ..." (and #include this header before the generated one)
+	to have every _direct field accessor count its calls in a thread-local counter: an increment, no synchronization.
+	Initializers (e.g., d.x(2)) are not counted; reads and in-place updates are.
+
+	A thread's counts are added to the process's totals when the thread exits, and the totals are appended
+	to the file named by the environment variable FLATS_PROFILE (default "flats.profile") when the process exits.
+	Threads that are still running when the process exits are not counted.
+
+	The file has a line "flat field count" per field; the generator adds up repeated lines (e.g., from several runs):
+		flats --profile=flats.profile direct schema.flat schema.h
+	lays out each profiled flat with its most used fields first (see make_object_map()).
+	The profile then is part of the layout: every user of the messages must generate with the same profile.
+*/
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace Flats
+{
+
+struct Access_info
+{ // generated for each flat: the names of its fields, by field index
+  const char* flat;
+  int fields;
+  const char* const* field_names;
+};
+
+class Access_totals
+{
+public:
+  static Access_totals& get()
+  {
+    static Access_totals t;
+    return t;
+  }
+
+  void add(const Access_info& info, const std::uint64_t* counts)
+  {
+    std::lock_guard<std::mutex> lock{mtx};
+    auto p = totals.begin();
+    while (p != totals.end() && p->first != &info)
+      ++p;
+    if (p == totals.end())
+      p = totals.insert(p, {&info, std::vector<std::uint64_t>(info.fields)});
+    for (int i = 0; i != info.fields; ++i)
+      p->second[i] += counts[i];
+  }
+
+  ~Access_totals()
+  {
+    const char* name = std::getenv("FLATS_PROFILE");
+    std::ofstream out{name ? name : "flats.profile", std::ios::app};
+    for (auto& [info, counts] : totals)
+      for (int i = 0; i != info->fields; ++i)
+        out << info->flat << ' ' << info->field_names[i] << ' ' << counts[i] << '\n';
+  }
+
+private:
+  Access_totals() = default;
+
+  std::mutex mtx;
+  std::vector<std::pair<const Access_info*, std::vector<std::uint64_t>>> totals;
+};
+
+template <int N>
+struct Access_counters
+{ // one per flat per thread
+  const Access_info& info;
+  std::uint64_t count[N] = {};
+
+  explicit Access_counters(const Access_info& a) : info{a}
+  {
+    Access_totals::get(); // construct the totals first, so that they outlive every thread's counters
+  }
+
+  ~Access_counters()
+  {
+    Access_totals::get().add(info, count);
+  }
+};
+
+} // namespace Flats
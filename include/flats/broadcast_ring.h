@@ -0,0 +1,325 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0.
+
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+#pragma once
+/*
+	Broadcast_ring: one writer, any number of readers, in shared memory (POSIX)
+
+	Every reader sees every message, and the writer places each message once, whatever the number of readers.
+	The writer never waits for readers: a reader that falls more than a ring behind is overrun and told so.
+
+	Slots have a fixed size (the largest message) and a sequence number, used like a seqlock:
+	odd while the writer is placing message i, 2*i+2 once it is complete.
+	A reader checks the sequence number before and after reading; if it changed, the message was overwritten
+	while being read and the read is reported as an overrun.
+
+	Writer:
+		Byte* p = ring.reserve();	// never waits; overwrites the oldest slot
+		auto m = place_M(p, ring.slot_size(), ring.slot_size() - sizeof(M) - sizeof(M::Flat), Zero_fixed_part{});
+		// ... fill m ...
+		ring.commit(m->wire_size());
+
+	Reader (each has its own Broadcast_reader, i.e. its own cursor):
+		Broadcast_reader r{ ring };	// starts with the next message written
+		auto s = r.read([&](std::span<const Byte> b) { auto m = place_M_reader(...b...); use(m->direct()); });
+		// s is ok, empty (nothing new), or overrun (the reader skipped to the latest message; see lost())
+
+	read() gives access in place, so the function may see a message that is being overwritten.
+	Its result must not be used unless read() returns ok, and it must tolerate nonsense:
+	with checking error policies, Span and Vector accesses are range checked; otherwise use copy() to read
+	into a private buffer and read the copy only if copy() returns ok.
+
+	The ring lives in a shared memory object: create(name, ...) and open(name) use shm_open();
+	anonymous(...) uses memfd_create(); share it with fork() or by passing fd().
+	If the shared memory can't be set up and the error policy doesn't stop us, the ring is left empty and unmapped:
+	slot_size() is 0, reserve() returns nullptr, and readers find nothing to read.
+*/
+
+#include "flat_types.h"
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Flats
+{
+inline namespace FLATS_POLICY
+{
+
+enum class Read_status
+{
+  ok,
+  empty, // nothing new
+  overrun // the writer lapped the reader
+};
+
+class Broadcast_ring
+{
+public:
+  static Broadcast_ring create(const char* name, int slots, int slot_size)
+  // a new ring of slots (rounded up to a power of two) slots of slot_size bytes
+  {
+    int fd = ::shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    expect([&] { return fd != -1; }, Error_code::shared_memory);
+    return Broadcast_ring{fd, slots, slot_size};
+  }
+
+  static Broadcast_ring open(const char* name)
+  {
+    int fd = ::shm_open(name, O_RDWR, 0);
+    expect([&] { return fd != -1; }, Error_code::shared_memory);
+    return Broadcast_ring{fd};
+  }
+
+  static void unlink(const char* name)
+  {
+    ::shm_unlink(name);
+  }
+
+  static Broadcast_ring anonymous(int slots, int slot_size)
+  {
+    int fd = ::memfd_create("flats_broadcast_ring", 0);
+    expect([&] { return fd != -1; }, Error_code::shared_memory);
+    return Broadcast_ring{fd, slots, slot_size};
+  }
+
+  explicit Broadcast_ring(int fd)
+  // map an existing ring; takes ownership of fd
+    : file{fd}
+  {
+    struct stat st;
+    bool ok = ::fstat(fd, &st) == 0 && sizeof(Control) < static_cast<std::size_t>(st.st_size);
+    expect([&] { return ok; }, Error_code::shared_memory);
+    if (!ok || !map(st.st_size))
+      return; // the error policy didn't stop us
+    ok = ctl->magic == magic && sizeof(Control) + ctl->slots * ctl->stride == bytes;
+    expect([&] { return ok; }, Error_code::shared_memory);
+    if (!ok)
+    {
+      unmap(); // the error policy didn't stop us
+      return;
+    }
+    head = ctl->head.load(std::memory_order_acquire);
+  }
+
+  Broadcast_ring(Broadcast_ring&& r) noexcept
+  {
+    swap(r);
+  }
+
+  Broadcast_ring& operator=(Broadcast_ring&& r) noexcept
+  {
+    swap(r);
+    return *this;
+  }
+
+  ~Broadcast_ring()
+  {
+    if (ctl)
+      ::munmap(ctl, bytes);
+    if (file != -1)
+      ::close(file);
+  }
+
+  int fd() const
+  {
+    return file;
+  }
+
+  int slot_size() const
+  {
+    return ctl ? ctl->slot_size : 0;
+  }
+
+  // writer:
+
+  Byte* reserve()
+  // the slot for the next message: slot_size() bytes
+  {
+    if (!ctl)
+      return nullptr; // unmapped
+    Slot* s = slot(head);
+    s->seq.store(2 * head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release); // readers must not see new bytes with the old sequence number
+    return s->data();
+  }
+
+  void commit(int n)
+  // publish the first n bytes of the reserved slot
+  {
+    if (!ctl)
+      return; // unmapped
+    Slot* s = slot(head);
+    s->size.store(n, std::memory_order_relaxed);
+    s->seq.store(2 * head + 2, std::memory_order_release);
+    ctl->head.store(++head, std::memory_order_release);
+  }
+
+private:
+  friend class Broadcast_reader;
+
+  static constexpr std::uint64_t magic = 0x7473616364616f72; // "roadcast"
+
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "Broadcast_ring needs lock-free 64-bit atomics");
+
+  struct Control
+  { // the beginning of the shared memory; the slots follow
+    std::uint64_t magic;
+    std::uint64_t slots; // a power of two
+    std::uint64_t stride; // bytes per slot, including its header
+    std::int32_t slot_size;
+    alignas(64) std::atomic<std::uint64_t> head; // messages ever written; readers look only to find where to start
+  };
+
+  struct alignas(64) Slot
+  { // a cache line of header, then the message
+    std::atomic<std::uint64_t> seq; // 2*i+1 while message i is being placed, 2*i+2 when it is complete
+    std::atomic<std::int32_t> size;
+
+    Byte* data()
+    {
+      return reinterpret_cast<Byte*>(this + 1);
+    }
+  };
+
+  Broadcast_ring(int fd, int slots, int size)
+  // initialize a new ring in fd; takes ownership of fd
+    : file{fd}
+  {
+    expect([&] { return 0 < slots && 0 < size; }, Error_code::small_buffer);
+    if (slots <= 0 || size <= 0)
+      return; // the error policy didn't stop us
+    std::uint64_t n = std::bit_ceil(static_cast<std::uint64_t>(slots));
+    std::uint64_t stride = sizeof(Slot) + (size + sizeof(Slot) - 1) / sizeof(Slot) * sizeof(Slot);
+    bool ok = ::ftruncate(fd, sizeof(Control) + n * stride) == 0;
+    expect([&] { return ok; }, Error_code::shared_memory);
+    if (!ok || !map(sizeof(Control) + n * stride))
+      return; // the error policy didn't stop us
+    new (ctl) Control{magic, n, stride, size, {0}};
+    for (std::uint64_t i = 0; i != n; ++i)
+      new (slot(i)) Slot{{0}, {0}};
+  }
+
+  bool map(std::size_t n)
+  // false if the mapping failed; the ring stays unmapped
+  {
+    void* p = ::mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    expect([&] { return p != MAP_FAILED; }, Error_code::shared_memory);
+    if (p == MAP_FAILED)
+      return false; // the error policy didn't stop us
+    ctl = static_cast<Control*>(p);
+    bytes = n;
+    return true;
+  }
+
+  void unmap()
+  {
+    ::munmap(ctl, bytes);
+    ctl = nullptr;
+    bytes = 0;
+  }
+
+  void swap(Broadcast_ring& r) noexcept
+  {
+    std::swap(file, r.file);
+    std::swap(ctl, r.ctl);
+    std::swap(bytes, r.bytes);
+    std::swap(head, r.head);
+  }
+
+  Slot* slot(std::uint64_t i) const
+  {
+    return reinterpret_cast<Slot*>(reinterpret_cast<Byte*>(ctl + 1) + (i & (ctl->slots - 1)) * ctl->stride);
+  }
+
+  int file = -1;
+  Control* ctl = nullptr;
+  std::size_t bytes = 0; // mapped
+  std::uint64_t head = 0; // writer: our copy of ctl->head
+};
+
+class Broadcast_reader
+{
+public:
+  explicit Broadcast_reader(const Broadcast_ring& r)
+  // start with the next message written
+    : ring{&r}, next{r.ctl ? r.ctl->head.load(std::memory_order_acquire) : 0}
+  {
+  }
+
+  template <class F>
+  Read_status read(F f)
+  // f(std::span<const Byte>) on the next message, in place
+  {
+    if (!ring->ctl)
+      return Read_status::empty; // unmapped
+    auto s = ring->slot(next);
+    std::uint64_t seq = s->seq.load(std::memory_order_acquire);
+    if (seq < 2 * next + 2)
+      return Read_status::empty;
+    if (seq != 2 * next + 2)
+      return skip();
+    int n = s->size.load(std::memory_order_relaxed);
+    if (n < 0 || ring->slot_size() < n) // overwritten after we looked at seq
+      return skip();
+    f(std::span<const Byte>{s->data(), static_cast<std::size_t>(n)});
+    std::atomic_thread_fence(std::memory_order_acquire); // the reads in f() before the second look at seq
+    if (s->seq.load(std::memory_order_relaxed) != seq)
+      return skip();
+    ++next;
+    return Read_status::ok;
+  }
+
+  Read_status copy(Byte* buf, int& n)
+  // copy the next message into buf[0:slot_size()) and set n to its size
+  {
+    return read([&](std::span<const Byte> b) {
+      kernels::copy_bytes(buf, b.data(), b.size());
+      n = static_cast<int>(b.size());
+    });
+  }
+
+  std::uint64_t lost() const
+  // messages skipped because of overruns
+  {
+    return lost_count;
+  }
+
+private:
+  Read_status skip()
+  // lapped: carry on with the most recent complete message
+  {
+    std::uint64_t h = ring->ctl->head.load(std::memory_order_acquire);
+    std::uint64_t to = (h == 0) ? 0 : h - 1;
+    if (next < to)
+    {
+      lost_count += to - next;
+      next = to;
+    }
+    return Read_status::overrun;
+  }
+
+  const Broadcast_ring* ring;
+  std::uint64_t next; // the message to read next
+  std::uint64_t lost_count = 0;
+};
+
+} // inline namespace FLATS_POLICY
+} // namespace Flats
@@ -0,0 +1,530 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0.
+
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+#pragma once
+/*
+	Dynamic access: reading the fields of flats that a program was not compiled with, through a binary object map
+	(see object_map_file.h), e.g., in a recorder, a router, or a debugging console
+
+		Dynamic_schema s{ "schema.map" };
+		const Access_plan& price = s.plan("Quote", "legs[].price");	// compiled once, then cached
+		for (int i = 0; i != n; ++i)
+			total += s.get(price, quote, {i}).to_double();
+
+	A path is field names separated by '.':
+		[N] selects element N of a vector, fixed_vector, or array; [] selects the element given by the next index to get()
+		an optional is looked through: if it is empty, the value is absent
+		a variant's alternative is selected by name: if another alternative is set, the value is absent
+		an index out of range gives an absent value
+	A message's map has one field, "flat", so a path into a message starts with "flat.", e.g., plan("M", "flat.s").
+	field(name, index) plans a field by its index, which is stable over versions.
+
+	A plan is a short vector of steps (add an offset, follow a Vector's Offset, check an optional's flag or a variant's tag),
+	so get() costs a few loads per step: no names are looked at once plan() has returned.
+	Plans are kept for the life of the Dynamic_schema, so a plan can be held and reused; finding one takes a lock.
+	Numbers are loaded with memcpy() in the wire byte order, so packed flats can be read too.
+	get() trusts the buffer, as the generated accessors do: use verify_M() on messages from untrusted sources.
+*/
+
+#include "flat_types.h"
+#include "object_map_file.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Flats
+{
+inline namespace FLATS_POLICY
+{
+
+enum class Dyn_type : std::uint8_t
+{
+  absent, // no such field, or not present
+  character,
+  integer,
+  unsigned_integer,
+  floating,
+  string,
+  vector,
+  fixed_vector,
+  array,
+  optional, // looked through by a plan, so never the type of a value
+  flat,
+  variant,
+  other // e.g., a preset type: just bytes
+};
+
+enum class Access_op : std::uint8_t
+{
+  add, // p += offset
+  optional, // absent unless filled; p += offset
+  variant, // absent unless utag == index; p += pos (at offset)
+  element, // p is a Vector: element index (of size bytes) if index < sz
+  fixed, // p is a fixed_vector: element index (of size bytes, the first at offset) if index < used
+  array // element index (of size bytes) if index < count
+};
+
+struct Access_step
+{
+  Access_op op;
+  int offset = 0; // add: bytes; optional: of the value; variant: of pos; fixed: of the first element
+  int size = 0; // element, fixed, array: bytes of an element
+  int index = 0; // element, fixed, array: which, or -1 for the next index given to get(); variant: the tag
+  int count = 0; // array: elements
+};
+
+struct Access_plan
+{
+  std::vector<Access_step> steps;
+  Dyn_type type = Dyn_type::absent; // of the value
+  int bytes = 0; // of the value
+  int count = 0; // array: elements
+  Dyn_type element = Dyn_type::absent; // string, vector, fixed_vector, array: of the elements
+  int indices = 0; // the number of []s
+  std::string type_name; // as in the object map
+};
+
+struct Dyn_value
+// a field found by get(): where it is and what it is
+{
+  Byte* p = nullptr; // nullptr: absent
+  const Access_plan* plan = nullptr;
+
+  bool is_present() const
+  {
+    return p;
+  }
+
+  Dyn_type type() const
+  {
+    return p ? plan->type : Dyn_type::absent;
+  }
+
+  std::int64_t to_int() const
+  // a character, integer, or unsigned integer; an unsigned 64-bit value may be seen as negative
+  {
+    expect([&] { return type() == Dyn_type::character || type() == Dyn_type::integer || type() == Dyn_type::unsigned_integer; },
+      Error_code::bad_field_path);
+    bool sign = plan->type != Dyn_type::unsigned_integer;
+    switch (plan->bytes)
+    {
+      case 1:
+        return sign ? std::int64_t(load<std::int8_t>()) : std::int64_t(load<std::uint8_t>());
+      case 2:
+        return sign ? std::int64_t(load<std::int16_t>()) : std::int64_t(load<std::uint16_t>());
+      case 4:
+        return sign ? std::int64_t(load<std::int32_t>()) : std::int64_t(load<std::uint32_t>());
+      case 8:
+        return load<std::int64_t>();
+      default:
+        return 0;
+    }
+  }
+
+  double to_double() const
+  // any number
+  {
+    if (type() != Dyn_type::floating)
+      return double(to_int());
+    return plan->bytes == 4 ? double(load<float>()) : load<double>();
+  }
+
+  std::string_view to_string() const
+  // a string, or the characters of a char array up to the first 0
+  {
+    if (type() == Dyn_type::array && plan->element == Dyn_type::character)
+    { // char[N]
+      auto s = reinterpret_cast<const char*>(p);
+      return {s, kernels::find_zero(s, plan->count)};
+    }
+    expect([&] { return type() == Dyn_type::string; }, Error_code::bad_field_path);
+    return {reinterpret_cast<const char*>(elements()), static_cast<std::size_t>(size())};
+  }
+
+  int size() const
+  // elements of a string, vector, fixed_vector, or array
+  {
+    switch (type())
+    {
+      case Dyn_type::string:
+      case Dyn_type::vector:
+      case Dyn_type::fixed_vector:
+        return Unaligned<Size>{p};
+      case Dyn_type::array:
+        return plan->count;
+      default:
+        return 0;
+    }
+  }
+
+  Byte* elements() const
+  // the first element of a string or vector
+  {
+    return p + Unaligned<Offset>{p + offsetof(Vector<char>, pos)};
+  }
+
+private:
+  template <class T>
+  T load() const
+  {
+    return Unaligned<Wire_t<T>>{p};
+  }
+};
+
+inline Dyn_value get(const Access_plan& plan, Byte* flat, std::initializer_list<int> indices = {})
+// the field of the flat (or message) at flat that plan leads to
+{
+  expect([&] { return plan.indices <= static_cast<int>(indices.size()); }, Error_code::bad_span_index);
+  auto next = indices.begin();
+  Byte* p = flat;
+  for (const Access_step& s : plan.steps)
+  {
+    int i = s.index;
+    if (i < 0)
+    {
+      if (next == indices.end())
+        return {};
+      i = *next++;
+    }
+    switch (s.op)
+    {
+      case Access_op::add:
+        p += s.offset;
+        break;
+      case Access_op::optional:
+        if (*p == Byte{0})
+          return {};
+        p += s.offset;
+        break;
+      case Access_op::variant:
+        if (static_cast<int>(*p) != s.index)
+          return {};
+        p += Unaligned<Offset>{p + s.offset};
+        break;
+      case Access_op::element:
+        if (i < 0 || Unaligned<Size>{p} <= i)
+          return {};
+        p += Unaligned<Offset>{p + offsetof(Vector<char>, pos)} + i * s.size;
+        break;
+      case Access_op::fixed:
+        if (i < 0 || Unaligned<Size>{p} <= i)
+          return {};
+        p += s.offset + i * s.size;
+        break;
+      case Access_op::array:
+        if (i < 0 || s.count <= i)
+          return {};
+        p += i * s.size;
+        break;
+    }
+  }
+  if (plan.type == Dyn_type::absent)
+    return {};
+  return {p, &plan};
+}
+
+class Dynamic_schema
+{
+public:
+  explicit Dynamic_schema(const char* path) : file{path}
+  {
+  }
+
+  explicit Dynamic_schema(Object_map_file&& f) : file{std::move(f)}
+  {
+  }
+
+  const Object_map_file& maps() const
+  {
+    return file;
+  }
+
+  bool is_message(const std::string& name) const
+  // is name a message (rather than a flat or variant)? paths into a message start with "flat."
+  {
+    Obj_map* m = file.find(name);
+    return m && m->direct().type_id() == type_id_message;
+  }
+
+  const Access_plan& plan(const std::string& flat, const std::string& path)
+  // the plan for path in flat (or message), compiled the first time it is asked for
+  {
+    std::string key = flat + ':' + path;
+    {
+      std::shared_lock<std::shared_mutex> lock{mtx};
+      auto p = plans.find(key);
+      if (p != plans.end())
+        return *p->second;
+    }
+    auto pl = std::make_unique<Access_plan>(compile(flat, path));
+    std::unique_lock<std::shared_mutex> lock{mtx};
+    auto [p, inserted] = plans.try_emplace(key, std::move(pl));
+    return *p->second;
+  }
+
+  const Access_plan& field(const std::string& flat, int index)
+  // the plan for the field with this index
+  {
+    if (Obj_map* m = file.find(flat))
+      for (auto f : m->direct().fields())
+        if (f.index() == index)
+          return plan(flat, as_string(f.name()));
+    expect([] { return false; }, Error_code::bad_field_path);
+    static const Access_plan none; // absent
+    return none;
+  }
+
+  Dyn_value get(const Access_plan& pl, Byte* flat, std::initializer_list<int> indices = {}) const
+  {
+    return Flats::get(pl, flat, indices);
+  }
+
+  Dyn_value get(const std::string& flat, const std::string& path, Byte* buf, std::initializer_list<int> indices = {})
+  // convenient, but finds the plan each time
+  {
+    return Flats::get(plan(flat, path), buf, indices);
+  }
+
+private:
+  struct Type_info
+  {
+    Dyn_type type = Dyn_type::other;
+    int bytes = 0;
+    int align = 1;
+    int count = 0; // array, fixed_vector
+    std::string inner; // the element type, the optional's type, or the flat or variant's name
+    Obj_map* map = nullptr; // of a flat or variant
+  };
+
+  static std::string as_string(Span<char> s)
+  {
+    return {s.begin(), s.end()};
+  }
+
+  static int round_up(int n, int a)
+  {
+    return (n + a - 1) / a * a;
+  }
+
+  static int to_count(std::string_view s)
+  // s is a decimal count or index, perhaps after spaces; -1 if it isn't
+  {
+    while (!s.empty() && s.front() == ' ')
+      s.remove_prefix(1);
+    int x = -1;
+    auto [p, ec] = std::from_chars(s.data(), s.data() + s.size(), x);
+    return (ec == std::errc{} && p == s.data() + s.size() && 0 <= x) ? x : -1;
+  }
+
+  static Type_info bad_type()
+  // a type_name in the map that doesn't parse: the map is corrupt
+  {
+    expect([] { return false; }, Error_code::bad_field_path);
+    return {};
+  }
+
+  Type_info describe(const std::string& t) const
+  // from the type_name of a Field_map
+  {
+    struct Number
+    {
+      std::string_view name;
+      Dyn_type type;
+      int bytes;
+    };
+    static constexpr Number numbers[] = {{"char", Dyn_type::character, 1}, {"int8", Dyn_type::integer, 1},
+      {"int16", Dyn_type::integer, 2}, {"int32", Dyn_type::integer, 4}, {"int64", Dyn_type::integer, 8},
+      {"uint8", Dyn_type::unsigned_integer, 1}, {"uint16", Dyn_type::unsigned_integer, 2},
+      {"uint32", Dyn_type::unsigned_integer, 4}, {"uint64", Dyn_type::unsigned_integer, 8},
+      {"float32", Dyn_type::floating, 4}, {"float64", Dyn_type::floating, 8}};
+
+    Type_info r;
+    auto inside = [&](std::string_view prefix) { // "prefix<X>" -> X
+      return t.substr(prefix.size() + 1, t.size() - prefix.size() - 2);
+    };
+    if (t == "string")
+      return {Dyn_type::string, size_of<String>(), alignof(String), 0, "char", nullptr};
+    for (auto& n : numbers)
+      if (t == n.name)
+        return {n.type, n.bytes, n.bytes, 0, {}, nullptr};
+    if (!t.empty() && t.back() == ']')
+    { // T[N]
+      auto b = t.rfind('[');
+      int count = to_count(std::string_view{t}.substr(b + 1, t.size() - b - 2));
+      if (count < 0)
+        return bad_type();
+      r = describe(t.substr(0, b));
+      r.count = count;
+      r.inner = t.substr(0, b);
+      r.type = Dyn_type::array;
+      r.bytes *= r.count;
+      return r;
+    }
+    if (t.starts_with("vector<"))
+      return {Dyn_type::vector, size_of<Vector<char>>(), alignof(Vector<char>), 0, inside("vector"), nullptr};
+    if (t.starts_with("optional<"))
+    {
+      Type_info x = describe(inside("optional"));
+      return {Dyn_type::optional, round_up(round_up(1, x.align) + x.bytes, x.align), x.align, 0, inside("optional"),
+        nullptr};
+    }
+    if (t.starts_with("fixed_vector<"))
+    { // fixed_vector<T, N>
+      auto s = inside("fixed_vector");
+      auto c = s.rfind(',');
+      int count = (c == std::string::npos) ? -1 : to_count(std::string_view{s}.substr(c + 1));
+      if (count < 0)
+        return bad_type();
+      Type_info x = describe(s.substr(0, c));
+      int align = std::max(static_cast<int>(alignof(Size)), x.align);
+      return {Dyn_type::fixed_vector, round_up(round_up(sizeof(Size), x.align) + count * x.bytes, align), align, count,
+        s.substr(0, c), nullptr};
+    }
+    if (Obj_map* m = file.find(t))
+    {
+      auto d = m->direct();
+      auto id = d.type_id();
+      if (id == type_id_flat || id == type_id_message)
+        r.type = Dyn_type::flat;
+      else if (id == type_id_variant)
+        r.type = Dyn_type::variant;
+      r.bytes = d.bytes();
+      r.align = d.align();
+      r.inner = t;
+      r.map = m;
+    }
+    return r;
+  }
+
+  Access_plan compile(const std::string& flat, const std::string& path) const
+  {
+    Access_plan pl;
+    auto fail = [&] {
+      expect([] { return false; }, Error_code::bad_field_path);
+      return Access_plan{};
+    };
+    auto add = [&](Access_step s) {
+      if (s.op == Access_op::add && !pl.steps.empty() && pl.steps.back().op == Access_op::add)
+        pl.steps.back().offset += s.offset;
+      else if (s.op != Access_op::add || s.offset)
+        pl.steps.push_back(s);
+    };
+
+    Type_info cur = describe(flat);
+    if (cur.type != Dyn_type::flat && cur.type != Dyn_type::variant)
+      return fail();
+    std::string type_name = flat;
+    std::string_view rest = path;
+    while (!rest.empty())
+    {
+      auto end = rest.find_first_of(".[");
+      std::string name{rest.substr(0, end)};
+      rest = (end == std::string_view::npos) ? std::string_view{} : rest.substr(end);
+
+      bool found = false;
+      for (auto f : cur.map->direct().fields())
+        if (as_string(f.name()) == name)
+        {
+          type_name = as_string(f.type_name());
+          Type_info next = describe(type_name);
+          next.bytes = f.bytes();
+          if (cur.type == Dyn_type::variant) // char utag; Offset pos; the alternative is in the tail
+            add({Access_op::variant, cur.align == 1 ? 1 : static_cast<int>(alignof(Offset)), 0, f.index() + 1});
+          else
+            add({Access_op::add, f.offset()});
+          cur = next;
+          found = true;
+          break;
+        }
+      if (!found)
+        return fail();
+
+      for (;;)
+      {
+        if (cur.type == Dyn_type::optional)
+        { // look through
+          Type_info x = describe(cur.inner);
+          add({Access_op::optional, round_up(1, x.align)});
+          cur = x;
+        }
+        if (rest.empty() || rest[0] != '[')
+          break;
+        auto close = rest.find(']');
+        if (close == std::string_view::npos)
+          return fail();
+        int i = -1;
+        if (1 < close)
+        {
+          i = to_count(rest.substr(1, close - 1));
+          if (i < 0)
+            return fail();
+        }
+        else
+          ++pl.indices;
+        rest = rest.substr(close + 1);
+        Type_info x = describe(cur.inner);
+        switch (cur.type)
+        {
+          case Dyn_type::vector:
+            add({Access_op::element, 0, x.bytes, i});
+            break;
+          case Dyn_type::fixed_vector:
+            add({Access_op::fixed, round_up(sizeof(Size), x.align), x.bytes, i});
+            break;
+          case Dyn_type::array:
+            add({Access_op::array, 0, x.bytes, i, cur.count});
+            break;
+          default:
+            return fail();
+        }
+        cur = x;
+      }
+
+      if (!rest.empty())
+      {
+        if (rest[0] != '.' || (cur.type != Dyn_type::flat && cur.type != Dyn_type::variant))
+          return fail();
+        rest.remove_prefix(1);
+      }
+    }
+    pl.type = cur.type;
+    pl.bytes = cur.bytes;
+    pl.count = cur.count;
+    if (cur.type == Dyn_type::string || cur.type == Dyn_type::vector || cur.type == Dyn_type::fixed_vector
+      || cur.type == Dyn_type::array)
+      pl.element = describe(cur.inner).type;
+    pl.type_name = cur.type == Dyn_type::flat || cur.type == Dyn_type::variant ? cur.inner : type_name;
+    return pl;
+  }
+
+  static constexpr int type_id_flat = 2; // Type_id::flat in the generator (bin/parser/flat.h)
+  static constexpr int type_id_message = 4; // Type_id::message
+  static constexpr int type_id_variant = 22; // Type_id::variant
+
+  Object_map_file file;
+  std::shared_mutex mtx;
+  std::map<std::string, std::unique_ptr<Access_plan>> plans; // "flat:path" -> plan
+};
+
+} // inline namespace FLATS_POLICY
+} // namespace Flats
@@ -0,0 +1,291 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0.
+
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+#pragma once
+/*
+	Byte kernels used by flat_types.h for the C-style strings stored in flats
+	and by generated messages for copying and initialization
+
+	The implementation is selected at compile time:
+		AVX2 if the compiler targets it (e.g., -mavx2 or -march=native)
+		SSE2 if the compiler targets it (every x86-64 compiler does)
+		otherwise a portable scalar loop
+
+	find_zero() reads whole aligned blocks, so it may look at bytes beyond the terminator
+	or the end of the range, but never past the aligned block holding the last byte it needs.
+	Aligned blocks never straddle a page, so this is safe; it is also what strlen() does.
+	Address sanitizers don't know that, so the vector version is exempted from instrumentation.
+
+	stream_copy() uses non-temporal stores: the copy does not displace the writer's cache
+	and does not need to read the destination lines first. That pays for large messages written into memory
+	(e.g., shared memory) that will be read by another core or process; for small ones, use copy_bytes().
+
+	byteswap() and byteswap_copy() convert numbers between host and wire byte order (see Wire in flat_types.h).
+
+	These kernels don't do error handling; the callers in flat_types.h do.
+*/
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h> // AVX2 implies SSE2
+#define FLATS_KERNEL_WIDTH 32
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FLATS_KERNEL_WIDTH 16
+#else
+#define FLATS_KERNEL_WIDTH 1 // scalar
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FLATS_NO_SANITIZE __attribute__((no_sanitize_address))
+#else
+#define FLATS_NO_SANITIZE
+#endif
+
+namespace Flats::kernels
+{
+
+#if FLATS_KERNEL_WIDTH == 32
+using Block = __m256i;
+
+FLATS_NO_SANITIZE inline unsigned zero_mask(const Block* p) // bit i is set if byte i of *p is 0
+{
+  return static_cast<unsigned>(
+    _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256(p), _mm256_setzero_si256())));
+}
+
+inline bool same_block(const char* a, const char* b)
+{
+  auto x = _mm256_loadu_si256(reinterpret_cast<const Block*>(a));
+  auto y = _mm256_loadu_si256(reinterpret_cast<const Block*>(b));
+  return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y))) == 0xFFFFFFFFu;
+}
+#elif FLATS_KERNEL_WIDTH == 16
+using Block = __m128i;
+
+FLATS_NO_SANITIZE inline unsigned zero_mask(const Block* p) // bit i is set if byte i of *p is 0
+{
+  return static_cast<unsigned>(
+    _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(p), _mm_setzero_si128())));
+}
+
+inline bool same_block(const char* a, const char* b)
+{
+  auto x = _mm_loadu_si128(reinterpret_cast<const Block*>(a));
+  auto y = _mm_loadu_si128(reinterpret_cast<const Block*>(b));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) == 0xFFFF;
+}
+#endif
+
+FLATS_NO_SANITIZE inline std::size_t find_zero(const char* s, std::size_t max)
+// index of the first 0 in s[0:max), or max if there is none
+{
+#if FLATS_KERNEL_WIDTH == 1
+  std::size_t i = 0;
+  while (i < max && s[i])
+    ++i;
+  return i;
+#else
+  constexpr std::size_t w = FLATS_KERNEL_WIDTH;
+  if (max == 0)
+    return 0;
+  auto skip = reinterpret_cast<std::uintptr_t>(s) % w; // bytes of the first block before s
+  auto p = reinterpret_cast<const Block*>(s - skip);
+  unsigned mask = zero_mask(p) >> skip;
+  std::size_t i = 0; // index in s of the first byte of block p
+  if (mask == 0)
+  {
+    i = w - skip;
+    while (i < max)
+    {
+      mask = zero_mask(++p);
+      if (mask)
+        break;
+      i += w;
+    }
+  }
+  if (mask == 0)
+    return max;
+  std::size_t r = i + std::countr_zero(mask);
+  return (r < max) ? r : max;
+#endif
+}
+
+inline bool bytes_equal(const char* a, const char* b, std::size_t n)
+// a[0:n) == b[0:n)
+{
+#if FLATS_KERNEL_WIDTH == 1
+  return std::memcmp(a, b, n) == 0;
+#else
+  constexpr std::size_t w = FLATS_KERNEL_WIDTH;
+  if (n < w)
+  { // short strings are the common case: compare in (possibly overlapping) words
+#if FLATS_KERNEL_WIDTH == 32
+    if (16 <= n)
+    {
+      auto x = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b)));
+      auto y = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + n - 16)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + n - 16)));
+      return _mm_testz_si128(_mm_or_si128(x, y), _mm_or_si128(x, y));
+    }
+#endif
+    if (8 <= n)
+    {
+      std::uint64_t x0, y0, x1, y1;
+      std::memcpy(&x0, a, 8);
+      std::memcpy(&y0, b, 8);
+      std::memcpy(&x1, a + n - 8, 8);
+      std::memcpy(&y1, b + n - 8, 8);
+      return ((x0 ^ y0) | (x1 ^ y1)) == 0;
+    }
+    if (4 <= n)
+    {
+      std::uint32_t x0, y0, x1, y1;
+      std::memcpy(&x0, a, 4);
+      std::memcpy(&y0, b, 4);
+      std::memcpy(&x1, a + n - 4, 4);
+      std::memcpy(&y1, b + n - 4, 4);
+      return ((x0 ^ y0) | (x1 ^ y1)) == 0;
+    }
+    for (std::size_t i = 0; i < n; ++i)
+      if (a[i] != b[i])
+        return false;
+    return true;
+  }
+  std::size_t i = 0;
+  for (; i + w <= n; i += w)
+    if (!same_block(a + i, b + i))
+      return false;
+  return i == n || same_block(a + n - w, b + n - w); // last (overlapping) block
+#endif
+}
+
+inline void copy_bytes(void* to, const void* from, std::size_t n)
+// to[0:n) = from[0:n); the ranges don't overlap
+{
+  std::memcpy(to, from, n);
+}
+
+inline void zero_bytes(void* p, std::size_t n)
+{
+  std::memset(p, 0, n);
+}
+
+constexpr std::size_t stream_min = 4096; // below this, the store fence costs more than streaming saves
+
+inline void stream_copy(void* to, const void* from, std::size_t n)
+// copy_bytes() with non-temporal stores, followed by a store fence
+{
+#if FLATS_KERNEL_WIDTH == 1
+  std::memcpy(to, from, n);
+#else
+  constexpr std::size_t w = FLATS_KERNEL_WIDTH;
+  auto d = static_cast<char*>(to);
+  auto s = static_cast<const char*>(from);
+  if (n < stream_min)
+  {
+    std::memcpy(d, s, n);
+    return;
+  }
+  std::size_t head = (w - reinterpret_cast<std::uintptr_t>(d) % w) % w; // streaming stores must be aligned
+  std::memcpy(d, s, head);
+  d += head;
+  s += head;
+  n -= head;
+  for (; w <= n; d += w, s += w, n -= w)
+#if FLATS_KERNEL_WIDTH == 32
+    _mm256_stream_si256(reinterpret_cast<Block*>(d), _mm256_loadu_si256(reinterpret_cast<const Block*>(s)));
+#else
+    _mm_stream_si128(reinterpret_cast<Block*>(d), _mm_loadu_si128(reinterpret_cast<const Block*>(s)));
+#endif
+  std::memcpy(d, s, n);
+  _mm_sfence(); // order the streaming stores before whatever publishes the copy
+#endif
+}
+
+template <class T>
+constexpr T byteswap(T x) // x with its bytes reversed
+{
+  static_assert(std::is_arithmetic_v<T> && (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8));
+  if constexpr (sizeof(T) == 1)
+    return x;
+  else
+  {
+    using U = std::conditional_t<sizeof(T) == 2, std::uint16_t, std::conditional_t<sizeof(T) == 4, std::uint32_t, std::uint64_t>>;
+    U u = std::bit_cast<U>(x);
+#if defined(__GNUC__) || defined(__clang__)
+    if constexpr (sizeof(T) == 2)
+      u = __builtin_bswap16(u);
+    else if constexpr (sizeof(T) == 4)
+      u = __builtin_bswap32(u);
+    else
+      u = __builtin_bswap64(u);
+#else
+    U r = 0;
+    for (std::size_t i = 0; i != sizeof(T); ++i, u >>= 8)
+      r = (r << 8) | (u & 0xFF);
+    u = r;
+#endif
+    return std::bit_cast<T>(u);
+  }
+}
+
+template <std::endian E, class T>
+constexpr T to_order(T x) // between host order and E; its own inverse
+{
+  if constexpr (E == std::endian::native)
+    return x;
+  else
+    return byteswap(x);
+}
+
+template <class T>
+inline void byteswap_copy(T* to, const T* from, std::size_t n)
+// to[i] = byteswap(from[i]) for i in [0:n); to == from is allowed
+{
+  std::size_t i = 0;
+#if FLATS_KERNEL_WIDTH == 32
+  if constexpr (sizeof(T) != 1)
+  {
+    constexpr int s = sizeof(T);
+    struct Mask
+    {
+      alignas(32) char b[32];
+    };
+    static constexpr Mask mask = [] { // reverse each group of s bytes
+      Mask m{};
+      for (int k = 0; k != 32; ++k)
+        m.b[k] = static_cast<char>((k % 16) / s * s + (s - 1 - k % s));
+      return m;
+    }();
+    const __m256i shuffle = _mm256_load_si256(reinterpret_cast<const __m256i*>(mask.b));
+    constexpr std::size_t per_block = 32 / sizeof(T);
+    for (; i + per_block <= n; i += per_block)
+    {
+      auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + i), _mm256_shuffle_epi8(x, shuffle));
+    }
+  }
+#endif
+  for (; i != n; ++i)
+    to[i] = byteswap(from[i]);
+}
+
+} // namespace Flats::kernels
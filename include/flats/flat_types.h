@@ -25,10 +25,56 @@
 	There were too little shared code among all Variants for it to be worthwhile; so they are generated.
 */
 
+#pragma once
 #include <string>
 #include <iostream>
 #include <cstddef>
 #include <exception>
+#include <limits>
+#include <cstring>
+#include <type_traits>
+#include <span>
+#include <iterator>
+#include <bit>
+#include <vector>
+#include "flat_kernels.h" // vectorized string kernels
+
+/*
+	Layout width: by default Offsets and Sizes are 16 bits, limiting a message to 32KB.
+	Define FLATS_WIDE_LAYOUT (consistently for the parser and all users) to get 32-bit Offsets and Sizes.
+	Generated code checks that it is compiled with the layout width it was generated for.
+
+	Error handling: define FLATS_ERROR_HANDLING as ignoring, throwing, terminating, logging, or testing
+	before #including this header to choose the policy for a translation unit; the default is testing.
+	The Flats types and the generated code are placed in an inline namespace named after the policy,
+	so translation units using different policies don't violate the one-definition rule.
+	Error reporting is out of line, so a check costs a compare and a (predicted) branch.
+
+	Wire byte order: by default numbers are stored in the host's byte order.
+	Define FLATS_WIRE_ORDER as little or big (consistently for all users) to fix the byte order of
+	Offsets, Sizes, and Versions in messages, and generate with "flats direct_little" or "flats direct_big"
+	to fix the byte order of numeric fields. Such numbers are stored as Wire<T, order>, which converts on access;
+	when the wire order is the host's, the conversion is a plain load or store.
+
+	Packed layout: generate with "flats packed" to lay out flats and variants without padding between fields.
+	Numeric fields of a packed flat are accessed through Unaligned<T>, which loads and stores with memcpy().
+	Vectors, Optionals, Arrays, etc. in a packed flat, and everything in the tail, are used in place,
+	possibly misaligned, so packed messages need hardware that tolerates misaligned access (e.g., x86-64, ARMv8).
+	Generated code checks that the compiler's layout matches the object map that the accessors rely on.
+*/
+
+#ifndef FLATS_ERROR_HANDLING
+#define FLATS_ERROR_HANDLING testing
+#endif
+#define FLATS_POLICY_NAME(p) policy_##p
+#define FLATS_POLICY_NAMESPACE(p) FLATS_POLICY_NAME(p)
+#define FLATS_POLICY FLATS_POLICY_NAMESPACE(FLATS_ERROR_HANDLING) // usage: inline namespace FLATS_POLICY {
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FLATS_COLD __attribute__((cold, noinline))
+#else
+#define FLATS_COLD
+#endif
 
 // hack to use either std concepts or TS concepts
 #define CBOOL bool
@@ -68,10 +114,136 @@ constexpr bool False = a;
 
 namespace Flats
 {
+inline namespace FLATS_POLICY
+{
 
 using Byte = std::byte; //  unsigned char;
-using Offset = short; // relative position measured in Bytes in a flat or message
-using Size = short; // the number of Bytes of something in a mesage or flat
+
+template <class T, std::endian E>
+struct Wire
+// a T stored in byte order E
+{
+  using value_type = T;
+  static constexpr std::endian order = E;
+  T raw;
+
+  Wire() = default;
+  Wire(T x) : raw{kernels::to_order<E>(x)}
+  {
+  }
+
+  operator T() const
+  {
+    return kernels::to_order<E>(raw);
+  }
+
+  Wire& operator=(T x)
+  {
+    raw = kernels::to_order<E>(x);
+    return *this;
+  }
+
+  Wire& operator+=(T x)
+  {
+    return *this = static_cast<T>(T(*this) + x);
+  }
+
+  Wire& operator-=(T x)
+  {
+    return *this = static_cast<T>(T(*this) - x);
+  }
+
+  Wire& operator++()
+  {
+    return *this += 1;
+  }
+
+  T operator++(int)
+  {
+    T old = *this;
+    *this += 1;
+    return old;
+  }
+};
+
+template <class T>
+constexpr bool is_wire = false;
+template <class T, std::endian E>
+constexpr bool is_wire<Wire<T, E>> = true;
+
+template <class T>
+struct Host_type // the type of a T's value on the host
+{
+  using type = T;
+};
+template <class T, std::endian E>
+struct Host_type<Wire<T, E>>
+{
+  using type = T;
+};
+
+template <class T>
+struct Unaligned
+// a reference to a T that may be misaligned, e.g., a field of a packed flat: loads and stores use memcpy()
+{
+  using value_type = typename Host_type<T>::type;
+  Byte* p;
+
+  operator value_type() const
+  {
+    T x;
+    std::memcpy(&x, p, sizeof(T));
+    return x;
+  }
+
+  Unaligned& operator=(value_type x)
+  {
+    T y = x;
+    std::memcpy(p, &y, sizeof(T));
+    return *this;
+  }
+
+  Unaligned& operator+=(value_type x)
+  {
+    return *this = static_cast<value_type>(value_type(*this) + x);
+  }
+
+  Unaligned& operator-=(value_type x)
+  {
+    return *this = static_cast<value_type>(value_type(*this) - x);
+  }
+
+  Unaligned& operator++()
+  {
+    return *this += 1;
+  }
+
+  value_type operator++(int)
+  {
+    value_type old = *this;
+    *this += 1;
+    return old;
+  }
+};
+
+#if defined(FLATS_WIRE_ORDER)
+constexpr std::endian wire_order = std::endian::FLATS_WIRE_ORDER; // checked by generated code
+#else
+constexpr std::endian wire_order = std::endian::native;
+#endif
+
+template <class T> // T in wire order, but no wrapper unless needed
+using Wire_t = std::conditional_t<wire_order == std::endian::native, T, Wire<T, wire_order>>;
+
+#ifdef FLATS_WIDE_LAYOUT
+using Offset_rep = int;
+#else
+using Offset_rep = short;
+#endif
+using Offset = Wire_t<Offset_rep>; // relative position measured in Bytes in a flat or message
+using Size = Wire_t<Offset_rep>; // the number of Bytes of something in a mesage or flat
+constexpr int layout_width = 8 * sizeof(Offset); // 16 or 32; checked by generated code
+constexpr int max_message_size = std::numeric_limits<Offset_rep>::max();
 using int64_t = long long;
 using uint64_t = unsigned long long;
 
@@ -84,6 +256,12 @@ class Writer
 class Reader_writer
 {
 };
+class Zero_fixed_part
+{
+}; // for overloading message constructors: zero only the Flat, not the tail
+class Stream
+{
+}; // for overloading clone(): bypass the cache when writing the copy
 
 template <class T>
 constexpr Size size_of()
@@ -132,7 +310,18 @@ enum class Error_code
   truncation,
   narrowing,
   variant_tag,
-  fixed_array_overflow
+  fixed_array_overflow,
+  shared_memory,
+  bad_message,
+  bad_version,
+  bad_vector,
+  bad_optional,
+  bad_variant,
+  absent_field,
+  file_error,
+  bad_field_path,
+  bad_filter,
+  misaligned
 };
 
 const std::string error_code_name[] = {
@@ -147,12 +336,49 @@ const std::string error_code_name[] = {
   "C-style string truncation",
   "narrowing",
   "bad variant tag",
-  "fixed array overflow"};
+  "fixed array overflow",
+  "shared memory setup failed",
+  "bad message header",
+  "wrong message version",
+  "vector outside the message",
+  "bad optional",
+  "bad variant",
+  "field not in the message's version",
+  "can't open or map file",
+  "no such field path in the object map",
+  "bad filter expression",
+  "buffer not aligned for the message"};
+
+constexpr Error_handling default_error_action = Error_handling::FLATS_ERROR_HANDLING;
+constexpr Error_handling check_cstring = default_error_action;
+constexpr Error_handling check_truncation = default_error_action;
+constexpr Error_handling check_narrowing = default_error_action;
+
+// the cold, out-of-line part of expect(); keeps iostream code and throws off the hot path:
+
+FLATS_COLD inline void log_error(Error_code x)
+{
+  std::cerr << "Flats error: " << int(x) << ' ' << error_code_name[int(x)] << '\n';
+}
+
+inline thread_local bool growing_tail = false; // Message_builder::apply() grows on tail_too_big; that's not worth a log line
 
-constexpr Error_handling default_error_action = Error_handling::testing;
-constexpr Error_handling check_cstring = Error_handling::testing;
-constexpr Error_handling check_truncation = Error_handling::testing;
-constexpr Error_handling check_narrowing = Error_handling::testing;
+[[noreturn]] FLATS_COLD inline void test_error(Error_code x)
+{
+  if (!(growing_tail && x == Error_code::tail_too_big))
+    log_error(x);
+  throw x;
+}
+
+[[noreturn]] FLATS_COLD inline void throw_error(Error_code x)
+{
+  throw x;
+}
+
+[[noreturn]] FLATS_COLD inline void terminate_error()
+{
+  std::terminate();
+}
 
 template <Error_handling action = default_error_action, class C>
 constexpr void expect(C cond, Error_code x) // C++17; a bit like assert()
@@ -161,29 +387,26 @@ constexpr void expect(C cond, Error_code x) // C++17; a bit like assert()
     return;
   else if constexpr (action == Error_handling::logging)
   {
-    if (!cond())
-      std::cerr << "Flats error: " << int(x) << ' ' << error_code_name[int(x)] << '\n';
+    if (!cond()) [[unlikely]]
+      log_error(x);
     return;
   }
   else if constexpr (action == Error_handling::testing)
   {
-    if (!cond())
-    {
-      std::cerr << "Flats error: " << int(x) << ' ' << error_code_name[int(x)] << '\n';
-      throw x;
-    }
+    if (!cond()) [[unlikely]]
+      test_error(x);
     return;
   }
   else if constexpr (action == Error_handling::throwing)
   {
-    if (!cond())
-      throw x;
+    if (!cond()) [[unlikely]]
+      throw_error(x);
     return;
   }
   else if constexpr (action == Error_handling::terminating)
   {
-    if (!cond())
-      std::terminate();
+    if (!cond()) [[unlikely]]
+      terminate_error();
     return;
   }
   else
@@ -198,6 +421,13 @@ inline Offset narrow(std::size_t x)
   return xx;
 }
 
+template <class M>
+void expect_aligned(const void* buf)
+// a message is placed in buf: an M of an aligned flat (e.g., "flat align 64") needs alignof(M)
+{
+  expect([buf] { return reinterpret_cast<std::uintptr_t>(buf) % alignof(M) == 0; }, Error_code::misaligned);
+}
+
 struct Extent
 // the number of elements of a given type in an array or vector
 {
@@ -210,7 +440,7 @@ struct Extent
 // Allocator and Version are not part of a Flat because they are shared by all Flats in a message
 struct Version
 {
-  int v;
+  Wire_t<int> v;
 };
 struct Tail_ref
 {
@@ -221,14 +451,13 @@ struct Tail_ref
 inline Size cstring_copy(char* to, const char* from, int max)
 // copy at most max characters
 {
-  const char* first = to;
-  while (*from)
-  {
-    expect<check_cstring>([max] { return 0 < max; }, Error_code::cstring_overflow);
-    --max;
-    *to++ = *from++;
-  }
-  return to - first;
+  std::size_t lim = (max < 0) ? 0 : max;
+  std::size_t n = kernels::find_zero(from, lim + 1); // look one further to detect overflow
+  expect<check_cstring>([n, lim] { return n <= lim; }, Error_code::cstring_overflow);
+  if (lim < n)
+    n = lim; // expect might not terminate
+  std::memcpy(to, from, n);
+  return static_cast<Size>(n);
 }
 
 struct Allocator
@@ -236,8 +465,8 @@ struct Allocator
   Offset next, max; // retative to the start of message
 
   Allocator(int n, int m)
-    : next{static_cast<Offset>(n)}
-    , max{static_cast<Offset>(m)}
+    : next{narrow(n)}
+    , max{narrow(m)}
   {
   }
   Allocator()
@@ -253,12 +482,16 @@ struct Allocator
   };
 
   Tail_ref place(const char* str)
-  {
+  { // a C-style string that runs past the end of the tail is a tail that is too small
     Offset pos = next;
-    char* p = reinterpret_cast<char*>(flat()) + pos;
-    Size sz = cstring_copy(p, str, max - next);
-    next += sz;
-    return {pos, sz};
+    std::size_t lim = capacity();
+    std::size_t n = kernels::find_zero(str, lim + 1); // look one further to detect overflow
+    expect([&] { return n <= lim; }, Error_code::tail_too_big);
+    if (lim < n)
+      n = lim; // the error policy didn't stop us
+    std::memcpy(reinterpret_cast<char*>(flat()) + pos, str, n);
+    next += static_cast<Size>(n);
+    return {pos, static_cast<Size>(n)};
   }
 
   Size capacity() const
@@ -303,7 +536,7 @@ struct Span
 
   Size size() const
   {
-    return last - first;
+    return static_cast<Size>(last - first);
   }
 
   bool is_present() const
@@ -342,13 +575,23 @@ struct Span
 
   void operator=(const char* p)
   {
-    for (T& t : *this)
+    if constexpr (std::is_same_v<T, char>)
+    { // copy the terminator if there is room for it
+      std::size_t max = size();
+      std::size_t n = kernels::find_zero(p, max + 1);
+      expect<check_truncation>([n, max] { return n <= max; }, Error_code::truncation);
+      std::memcpy(first, p, (n < max) ? n + 1 : max);
+    }
+    else
     {
-      t = *p++;
-      if (t == 0)
-        return;
+      for (T& t : *this)
+      {
+        t = *p++;
+        if (t == 0)
+          return;
+      }
+      expect<check_truncation>([p] { return *p == 0; }, Error_code::truncation);
     }
-    expect<check_truncation>([p] { return *p == 0; }, Error_code::truncation);
   }
 
   void operator=(const std::string& s)
@@ -374,13 +617,18 @@ struct Span
 
   const std::string to_string() const
   {
-    std::string res;
-    for (char x : *this)
-      if (x)
-        res += x;
-      else
-        break;
-    return res;
+    if constexpr (std::is_same_v<std::remove_const_t<T>, char>)
+      return std::string(first, kernels::find_zero(first, size()));
+    else
+    {
+      std::string res;
+      for (char x : *this)
+        if (x)
+          res += x;
+        else
+          break;
+      return res;
+    }
   }
 };
 
@@ -529,6 +777,35 @@ void place([[maybe_unused]] Allocator* a, T* t, std::initializer_list<Optional_i
   }
 }
 
+template <class T, class X>
+void place_range([[maybe_unused]] Allocator* a, T* t, const X* first, const X* last)
+// initialize T[i] from first[i]
+// a single memcpy() if T and X are the same trivially copyable type; otherwise, a placement loop
+{
+  if constexpr (std::is_same_v<T, X> && std::is_trivially_copyable_v<T>)
+  {
+    if (first != last)
+      std::memcpy(t, first, (last - first) * sizeof(T));
+  }
+  else if constexpr (is_wire<T> && std::is_same_v<typename T::value_type, X>)
+  { // host order to wire order
+    if constexpr (T::order == std::endian::native)
+      std::memcpy(t, first, (last - first) * sizeof(T));
+    else
+      kernels::byteswap_copy(reinterpret_cast<X*>(t), first, last - first);
+  }
+  else
+  {
+    for (; first != last; ++first, ++t)
+      if constexpr (std::is_constructible<T, Allocator*, X>::value)
+        place_one_alloc(a, t, *first);
+      else if constexpr (std::is_constructible<T, X>::value)
+        place_one(t, *first);
+      else
+        static_assert(False<>, "Cannot construct T from range element");
+  }
+}
+
 template <class T, class X>
 void place(Allocator* a, T* t, std::initializer_list<X> lst)
 // initialize T[i] from lst[i]
@@ -730,6 +1007,9 @@ struct Optional_ref
   }
 };
 */
+template <typename T>
+struct Vector_appender;
+
 template <typename T>
 struct Vector
 { // Refers to "the variable part" of a message starting at sizeof(this message)";
@@ -740,7 +1020,7 @@ struct Vector
 
   Size nbytes() const
   {
-    return sz * sizeof(T);
+    return narrow(sz * sizeof(T));
   } // number of bytes of elements
   bool is_empty() const
   {
@@ -780,8 +1060,21 @@ struct Vector
     place(a, begin(), lst);
   }
 
+  template <class X, std::size_t N>
+  Vector(Allocator* a, std::span<X, N> s) // bulk: memcpy() for trivially copyable elements
+    : sz{narrow(s.size())}, pos{alloc(a)}
+  {
+    place_range(a, begin(), s.data(), s.data() + s.size());
+  }
+
+  template <std::contiguous_iterator It>
+  Vector(Allocator* a, It first, It last)
+    : Vector(a, std::span{std::to_address(first), static_cast<std::size_t>(last - first)})
+  {
+  }
+
   Vector(Allocator* a, const std::string& s)
-    : sz{static_cast<Size>(s.size())}, pos{alloc(a)}
+    : sz{narrow(s.size())}, pos{alloc(a)}
   {
     std::copy(s.data(), s.data() + s.size(), begin());
   }
@@ -857,19 +1150,102 @@ struct Vector
     push(a);
     place_one_alloc(a, &begin()[sz - 1], v);
   }
+
+  // growing a vector that is not the last thing allocated in the tail:
+  // its elements are moved to the end of the tail and the space they occupied is abandoned.
+  // only for trivially copyable elements; others (e.g., Strings) hold positions relative to themselves
+
+  bool is_last(const Allocator* a) const
+  {
+    return reinterpret_cast<const Byte*>(end()) ==
+      reinterpret_cast<const Byte*>(a + 1) + a->next; // a->flat()
+  }
+
+  void relocate(Allocator* a, int n) requires std::is_trivially_copyable_v<T>
+  // move to the end of the tail with room for n elements
+  {
+    Byte* q = a->flat() + a->allocate(n * sizeof(T));
+    if (sz)
+      std::memcpy(q, begin(), sz * sizeof(T));
+    pos = narrow(q - reinterpret_cast<Byte*>(this));
+  }
+
+  void append(Allocator* a, std::span<const T> s) requires std::is_trivially_copyable_v<T>
+  // in place if this is the last allocation; otherwise by relocation
+  {
+    int n = static_cast<int>(s.size());
+    if (is_last(a))
+      a->allocate(n * sizeof(T));
+    else
+      relocate(a, sz + n);
+    if (n)
+      std::memcpy(end(), s.data(), n * sizeof(T));
+    sz = narrow(sz + n);
+  }
+
+  Vector_appender<T> reserve(Allocator* a, Extent n) requires std::is_trivially_copyable_v<T>
+  // reserve room for n elements and return a handle for appending to them
+  {
+    Vector_appender<T> r{this, a, sz};
+    r.reserve(n.sz);
+    return r;
+  }
+
   // subscripting, range checking: use Span
 };
 
-inline bool operator==(Span<char> sp, const char* p)
+template <typename T>
+struct Vector_appender
+/*
+	Builder-side handle for growing a Vector while other fields are being placed.
+	The message records only a Vector's size, so the capacity reserved for it is kept here.
+	Several Vectors can grow independently: a Vector that runs out of room while not being last in the tail
+	is relocated to the end of the tail with double capacity, so appending is amortized O(1) per element.
+*/
 {
-  for (char ch : sp)
+  Vector<T>* v;
+  Allocator* a;
+  int cap; // number of elements reserved for v
+
+  void reserve(int n)
   {
-    if (*p == 0 && ch == 0)
-      return true;
-    if (*p++ != ch)
-      return false;
+    if (n <= cap)
+      return;
+    auto last = reinterpret_cast<Byte*>(v->begin() + cap);
+    if (last == a->flat() + a->next)
+      a->allocate((n - cap) * sizeof(T)); // the reserved space is last in the tail: extend it
+    else
+      v->relocate(a, n);
+    cap = n;
+  }
+
+  void append(std::span<const T> s)
+  {
+    int need = v->size() + static_cast<int>(s.size());
+    if (cap < need)
+      reserve((need < 2 * cap) ? 2 * cap : need);
+    if (s.size())
+      std::memcpy(v->end(), s.data(), s.size() * sizeof(T));
+    v->sz = narrow(need);
+  }
+
+  void push(const T& x)
+  {
+    append(std::span<const T>{&x, 1});
+  }
+
+  int capacity() const
+  {
+    return cap;
   }
-  return true;
+};
+
+inline bool operator==(Span<char> sp, const char* p)
+// equal up to p's terminator, which may match a terminator in sp or sp's end
+{
+  std::size_t max = sp.size();
+  std::size_t n = kernels::find_zero(p, max);
+  return kernels::bytes_equal(sp.begin(), p, n) && (n == max || sp.begin()[n] == 0);
 }
 
 inline bool operator==(const char* p, Span<char> sp)
@@ -891,11 +1267,7 @@ inline bool operator==(Span<char> sp, const std::string& s)
 {
   if (sp.size() != size_of(s))
     return false;
-  auto p = &*s.cbegin();
-  for (char ch : sp)
-    if (*p++ != ch)
-      return false;
-  return true;
+  return kernels::bytes_equal(sp.begin(), s.data(), s.size());
 }
 
 inline bool operator==(const std::string& s, Span<char> sp)
@@ -915,6 +1287,21 @@ inline bool operator!=(Span<char> sp, const std::string& s)
 
 using String = Vector<char>;
 
+inline void rebase_vector(Byte* p, int delta)
+// the header of a Vector or String at p (perhaps unaligned) has been copied to where it is delta bytes closer
+// to its elements than it was (see the generated upgrade_M()); an empty one refers to nothing and is left alone
+{
+  if (Unaligned<Size>{p} != 0)
+    Unaligned<Offset>{p + offsetof(Vector<char>, pos)} += delta;
+}
+
+inline void rebase_variant(Byte* p, int delta, bool packed = false)
+// ditto for a variant (char utag; Offset pos;); an unset one (utag == 0) is left alone
+{
+  if (*p != Byte{0})
+    Unaligned<Offset>{p + (packed ? 1 : alignof(Offset))} += delta;
+}
+
 template <class T, int N>
 struct Array
 { // like Span, a pure accessor; N consecutive elements of type T
@@ -965,6 +1352,20 @@ struct Array
     place(&val[0], lst);
   }
 
+  template <class X, std::size_t M>
+    requires(!std::is_constructible_v<T, Allocator*, X>) // no tail to place elements in
+  Array(std::span<X, M> s)
+  {
+    expect([&] { return N == s.size(); }, Error_code::array_initializer);
+    place_range(nullptr, &val[0], s.data(), s.data() + ((s.size() < N) ? s.size() : N));
+  }
+
+  template <std::contiguous_iterator It>
+  Array(It first, It last)
+    : Array(std::span{std::to_address(first), static_cast<std::size_t>(last - first)})
+  {
+  }
+
   Array(const char* str)
   {
     for (char& x : val)
@@ -984,6 +1385,14 @@ struct Push
 {
 }; // Used in user interface code to indicate a wish to push()
 
+struct Append
+{
+}; // Used in user interface code to indicate a wish to append() a sequence
+
+struct Reserve
+{
+}; // Used in user interface code to indicate a wish to reserve() room for growth
+
 #include <cassert>
 template <class T, int N>
 struct Fixed_vector
@@ -1039,6 +1448,21 @@ struct Fixed_vector
     used = lst.size();
   }
 
+  template <class X, std::size_t M>
+    requires(!std::is_constructible_v<T, Allocator*, X>) // no tail to place elements in
+  Fixed_vector(std::span<X, M> s)
+  {
+    expect([&] { return s.size() <= N; }, Error_code::array_initializer);
+    used = narrow((s.size() < N) ? s.size() : N); // expect might not terminate
+    place_range(nullptr, &val[0], s.data(), s.data() + used);
+  }
+
+  template <std::contiguous_iterator It>
+  Fixed_vector(It first, It last)
+    : Fixed_vector(std::span{std::to_address(first), static_cast<std::size_t>(last - first)})
+  {
+  }
+
   Fixed_vector(const char* str)
   {
     for (char& x : val)
@@ -1089,6 +1513,319 @@ struct Fixed_vector
   }
 };
 
+// Unchecked accessors: no range, presence, or tag checks, for messages that have passed a generated verify_M().
+// Reachable only through the generated M_verified token; see verified_M().
+
+template <typename T>
+struct Unchecked_span : Span<T>
+{
+  Unchecked_span(T* p, T* q) : Span<T>{p, q}
+  {
+  }
+
+  T& operator[](int i) requires is_concrete<T>
+  {
+    return this->first[i];
+  }
+
+  const T& operator[](int i) const requires is_concrete<T>
+  {
+    return this->first[i];
+  }
+
+  auto operator[](int i) requires is_vector<T> || is_array<T>
+  {
+    return Unchecked_span<typename T::value_type>{this->first[i].begin(), this->first[i].end()};
+  }
+
+  auto operator[](int i) const requires is_vector<T> || is_array<T>
+  {
+    return Unchecked_span<const typename T::value_type>{this->first[i].begin(), this->first[i].end()};
+  }
+};
+
+template <class T, class TU>
+struct Unchecked_span_ref
+// Span_ref for verified messages: elements of the Flat T are presented through the unchecked accessor TU
+{
+  T* first;
+  T* last;
+
+  struct Ptr_ref
+  {
+    T* p;
+    Ptr_ref& operator++()
+    {
+      ++p;
+      return *this;
+    }
+    bool operator==(const Ptr_ref&) const = default;
+    TU operator*() const
+    {
+      return {p};
+    }
+  };
+
+  Ptr_ref begin() const
+  {
+    return {first};
+  }
+
+  Ptr_ref end() const
+  {
+    return {last};
+  }
+
+  int size() const
+  {
+    return last - first;
+  }
+
+  bool is_present() const
+  {
+    return size();
+  } // pretend to be optional
+
+  bool is_empty() const
+  {
+    return size() == 0;
+  } // pretend to be a container
+
+  TU operator[](int i) const
+  {
+    return {first + i};
+  }
+};
+
+template <class T>
+struct Unchecked_optional
+{
+  Optional<T>* p;
+
+  bool is_present() const
+  {
+    return p->filled;
+  }
+
+  bool is_empty() const
+  {
+    return !is_present();
+  } // pretend to be a container
+
+  T& access() const
+  {
+    return p->val;
+  }
+};
+
+template <class T, class TU>
+struct Unchecked_optional_ref
+// an optional Flat T, presented through the unchecked accessor TU
+{
+  Optional<T>* p;
+
+  bool is_present() const
+  {
+    return p->filled;
+  }
+
+  bool is_empty() const
+  {
+    return !is_present();
+  } // pretend to be a container
+
+  TU access() const
+  {
+    return {&p->val};
+  }
+};
+
+template <class T, std::endian E>
+void to_host(Span<Wire<T, E>> s, T* out)
+// out[i] = s[i] for numbers in wire order: a bulk copy, swapping bytes if need be
+{
+  if constexpr (E == std::endian::native)
+    std::memcpy(out, s.begin(), s.size() * sizeof(T));
+  else
+    kernels::byteswap_copy(out, reinterpret_cast<const T*>(s.begin()), s.size());
+}
+
+struct Verify_result
+{ // from a generated verify_M(): the first problem found, if any
+  bool ok = true;
+  Error_code error = Error_code::bad_message;
+  int offset = 0; // of the offending field, in bytes from the start of the buffer
+
+  explicit operator bool() const
+  {
+    return ok;
+  }
+};
+
+class Verifier
+/*
+	Checks, without trusting anything in it, that every position in a received message stays inside it:
+	the generated verify_M() checks the message header and calls verify() on the Flat;
+	the generated verify(const X&, Verifier&) for each Flat X checks its fields in order;
+	Verifier checks one Vector, Optional, Array, or Fixed_vector at a time and loops over elements that need checking.
+	No accessor is used and nothing is dereferenced until its bounds have been checked.
+	All the code is inline, so a message is checked in a single, mostly branch-free pass.
+*/
+{
+public:
+  Verifier(const Byte* buffer, const Byte* tail_begin, const Byte* tail_end)
+    : base{buffer}, lo{tail_begin - buffer}, hi{tail_end - buffer}
+  {
+  }
+
+  template <class T>
+  bool check(const T& x)
+  {
+    if constexpr (std::is_arithmetic_v<T> || std::is_enum_v<T> || is_wire<T>)
+      return true;
+    else
+      return verify(x, *this); // generated for Flats and variants
+  }
+
+  template <class T>
+  bool check(const Vector<T>& v)
+  {
+    if (v.sz == 0)
+      return true;
+    std::ptrdiff_t first = where(&v) + v.pos;
+    if (v.sz < 0 || first < lo || hi < first || (hi - first) / static_cast<std::ptrdiff_t>(sizeof(T)) < v.sz)
+      return fail(Error_code::bad_vector, &v);
+    return elements(reinterpret_cast<const T*>(base + first), v.sz);
+  }
+
+  template <class T>
+  bool check(const Optional<T>& x)
+  {
+    unsigned char filled;
+    std::memcpy(&filled, &x.filled, 1); // not yet known to be a valid bool
+    if (1 < filled)
+      return fail(Error_code::bad_optional, &x);
+    return !filled || check(x.val);
+  }
+
+  template <class T, int N>
+  bool check(const Array<T, N>& x)
+  {
+    return elements(x.val, N);
+  }
+
+  template <class T, int N>
+  bool check(const Fixed_vector<T, N>& x)
+  {
+    if (x.used < 0 || N < x.used)
+      return fail(Error_code::fixed_array_overflow, &x);
+    return elements(x.val, x.used);
+  }
+
+  template <class T>
+  const T* alternative(const void* variant, Offset pos)
+  // the selected alternative of a variant, at pos relative to the variant, or nullptr if that is outside the tail
+  {
+    std::ptrdiff_t first = where(variant) + pos;
+    if (first < lo || hi < first || hi - first < static_cast<std::ptrdiff_t>(sizeof(T)))
+    {
+      fail(Error_code::bad_variant, variant);
+      return nullptr;
+    }
+    return reinterpret_cast<const T*>(base + first);
+  }
+
+  bool fail(Error_code e, const void* p)
+  {
+    res = {false, e, static_cast<int>(where(p))};
+    return false;
+  }
+
+  Verify_result result() const
+  {
+    return res;
+  }
+
+private:
+  std::ptrdiff_t where(const void* p) const
+  {
+    return static_cast<const Byte*>(p) - base;
+  }
+
+  template <class T>
+  bool elements(const T* p, int n)
+  {
+    if constexpr (!(std::is_arithmetic_v<T> || std::is_enum_v<T>))
+      for (int i = 0; i != n; ++i)
+        if (!check(p[i]))
+          return false;
+    return true;
+  }
+
+  const Byte* base;
+  std::ptrdiff_t lo; // the tail: [lo:hi) relative to base
+  std::ptrdiff_t hi;
+  Verify_result res;
+};
+
+// Batches: the columns of the generated <Flat>_batch containers (structure of arrays).
+// A scalar field is a std::vector<T>; a String or Vector field is a Ragged_column<T>.
+// Columns are presented as std::spans rather than Spans: a batch can hold more elements than a Size can count.
+
+template <class T>
+class Ragged_column
+// the elements of a String or Vector field of every row: row i is values()[offsets()[i]:offsets()[i+1])
+{
+public:
+  template <class It>
+  void append(It first, It last)
+  {
+    vals.insert(vals.end(), first, last);
+    offs.push_back(vals.size());
+  }
+
+  std::size_t size() const // rows
+  {
+    return offs.size() - 1;
+  }
+
+  Span<T> operator[](std::size_t i)
+  {
+    expect([&] { return i < size(); }, Error_code::bad_span_index);
+    return {vals.data() + offs[i], vals.data() + offs[i + 1]};
+  }
+
+  std::span<T> values()
+  {
+    return vals;
+  }
+
+  std::span<const T> values() const
+  {
+    return vals;
+  }
+
+  std::span<const std::size_t> offsets() const // size()+1 entries
+  {
+    return offs;
+  }
+
+  void reserve(std::size_t rows)
+  {
+    offs.reserve(rows + 1);
+  }
+
+  void clear()
+  {
+    vals.clear();
+    offs.resize(1);
+  }
+
+private:
+  std::vector<T> vals;
+  std::vector<std::size_t> offs{0};
+};
+
 inline std::ostream& operator<<(std::ostream& out, Span<char> s)
 {
   for (char x : s)
@@ -1136,4 +1873,5 @@ std::ostream& operator<<(std::ostream& os, T& v)
   return os << Span<T>(v);
 }
 
+} // inline namespace FLATS_POLICY
 } // namespace Flats
@@ -0,0 +1,159 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0.
+
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+#pragma once
+/*
+	Message_builder<M>: build an M in a buffer that grows when the tail runs short
+
+	Growing relocates the message with the generated M::grow_into(): a single memcpy() of what has
+	been built so far; nothing is re-encoded. Growing doubles the buffer, so the cost is amortized.
+
+	Relocation invalidates pointers into the old buffer, including _direct accessors,
+	so get a fresh accessor from direct() after anything that can grow:
+
+		Message_builder<M> b{ 256 };	// initial tail estimate
+		b.reserve(s.size());		// make room, then
+		b.direct().name(s);		// place
+
+	or let apply() do it: it retries an initializer that ran out of tail space after growing,
+	giving back the tail space the failed attempt took
+	(that requires an error policy that throws, so that the failure can be caught):
+
+		b.apply([&](auto d) { d.values(big_vector); });
+*/
+
+#include "flat_types.h"
+#include <algorithm>
+#include <memory>
+#include <new>
+
+namespace Flats
+{
+inline namespace FLATS_POLICY
+{
+
+template <class M>
+class Message_builder
+{
+public:
+  explicit Message_builder(int size_of_tail)
+  {
+    allocate(sizeof(M) + sizeof(typename M::Flat) + size_of_tail);
+    msg = new (buf.get()) M{bytes, size_of_tail}; // buf is aligned for M
+  }
+
+  M* message()
+  {
+    return msg;
+  }
+
+  auto direct()
+  {
+    return msg->direct();
+  }
+
+  void reserve(int n)
+  // make sure that at least n bytes are free in the tail; may relocate the message
+  {
+    if (n <= msg->current_capacity())
+      return;
+    int need = msg->current_size() + n;
+    long long sz = 2LL * bytes;
+    grow((sz < need) ? need : sz);
+  }
+
+  template <class F>
+  void apply(F f)
+  // f(direct()), growing and retrying if the tail is too small
+  {
+    static_assert(
+      default_error_action == Error_handling::throwing || default_error_action == Error_handling::testing,
+      "Message_builder::apply() needs an error policy that throws");
+    while (true)
+    {
+      auto next = msg->alloc.next; // give back what a failed attempt took from the tail
+      try
+      {
+        Growing g;
+        f(msg->direct());
+        return;
+      }
+      catch (Error_code e)
+      {
+        if (e != Error_code::tail_too_big)
+          throw;
+        if (limit() <= bytes)
+        {
+          if constexpr (default_error_action == Error_handling::testing)
+            log_error(e); // not logged while we could still grow
+          throw;
+        }
+        msg->alloc.next = next;
+        grow(2LL * bytes);
+      }
+    }
+  }
+
+private:
+  static constexpr std::size_t align = std::max(alignof(M), alignof(std::max_align_t)); // of the buffer
+
+  struct Free
+  {
+    void operator()(Byte* p) const
+    {
+      ::operator delete(p, std::align_val_t{align});
+    }
+  };
+
+  struct Growing // tail_too_big is expected while apply() runs f
+  {
+    bool was = growing_tail;
+    Growing()
+    {
+      growing_tail = true;
+    }
+    ~Growing()
+    {
+      growing_tail = was;
+    }
+  };
+
+  void allocate(int n)
+  {
+    bytes = n;
+    buf.reset(static_cast<Byte*>(::operator new((n + align - 1) / align * align, std::align_val_t{align})));
+  }
+
+  static long long limit() // alloc.max is an Offset
+  {
+    return static_cast<long long>(sizeof(M)) + max_message_size;
+  }
+
+  void grow(long long n)
+  {
+    if (limit() < n)
+      n = limit();
+    auto old = std::move(buf);
+    auto old_msg = msg;
+    allocate(static_cast<int>(n));
+    msg = old_msg->grow_into(buf.get(), n);
+  }
+
+  std::unique_ptr<Byte, Free> buf;
+  int bytes = 0; // size of buf
+  M* msg = nullptr;
+};
+
+} // inline namespace FLATS_POLICY
+} // namespace Flats
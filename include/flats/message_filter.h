@@ -0,0 +1,414 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0.
+
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+#pragma once
+/*
+	Filters: predicates on the fields of messages, evaluated on the raw bytes, without accessors or copies,
+	e.g., for a router that drops most messages on one or two field values
+
+		Dynamic_schema s{ "schema.map" };	// see dynamic_accessor.h
+		Filter f{ s, "Quote", "price > 100 && side == 'B' && symbol == \"ABC\"" };
+		if (f(buf)) forward(buf);
+		int n = f.evaluate(bufs, hits);	// one filter over many messages
+
+	Expressions:
+		comparison:	path op literal, where op is one of == != < <= > >=
+		literal:	integer, floating point, 'c', or "string"
+		combined with && || ! and parentheses, with the usual precedence
+	A path is as for Dynamic_schema::plan() (without []); for a message, "flat." is implied.
+	A comparison on a field that is absent (an empty optional, another alternative of a variant, an index out of range) is false.
+	Strings and char arrays compare as strings, characters and integers as integers, and numbers with a floating point as doubles.
+	An expression that doesn't compile is a bad_filter; if the error policy doesn't stop us, the filter passes nothing.
+
+	The expression is compiled once, against the object map, into a flat sequence of operations:
+	comparisons, which leave their result in an accumulator, and jumps on the accumulator for && and ||.
+	A field directly in the flat (or a nested flat) is loaded from its offset; others are found through their access plan.
+*/
+
+#include "dynamic_accessor.h"
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Flats
+{
+inline namespace FLATS_POLICY
+{
+
+enum class Filter_code : std::uint8_t
+{
+  compare_int, // acc = field cmp i
+  compare_double, // acc = field cmp d
+  compare_string, // acc = field cmp strings[str]
+  jump_if_false, // to jump
+  jump_if_true,
+  negate // acc = !acc
+};
+
+enum class Compare : std::uint8_t
+{
+  eq,
+  ne,
+  lt,
+  le,
+  gt,
+  ge
+};
+
+struct Filter_op
+{
+  Filter_code code;
+  Compare cmp = Compare::eq;
+  bool direct = false; // the field is at offset in the flat: no plan needed
+  bool sign = true; // of a direct integer
+  bool floating = false; // a direct float or double
+  int bytes = 0; // of a direct number
+  int offset = 0;
+  const Access_plan* plan = nullptr;
+  int jump = 0; // index of the next operation if the jump is taken
+  std::int64_t i = 0;
+  double d = 0;
+  int str = 0; // index in strings
+};
+
+class Filter
+{
+public:
+  Filter(Dynamic_schema& s, const std::string& type, std::string_view expr)
+  // compile expr for the flat, variant, or message called type
+    : schema{s}, root{type}, prefix{s.is_message(type) ? "flat." : ""}, text{expr}
+  {
+    parse_or();
+    skip();
+    if (pos != text.size())
+      fail();
+    text = {};
+    if (failed)
+      code.clear(); // what did compile might match too much; a filter that doesn't compile passes nothing
+  }
+
+  bool operator()(Byte* flat) const
+  // does the flat (or message) at flat pass?
+  {
+    if (failed)
+      return false;
+    bool acc = false;
+    int n = static_cast<int>(code.size());
+    for (int pc = 0; pc < n; ++pc)
+    {
+      const Filter_op& op = code[pc];
+      switch (op.code)
+      {
+        case Filter_code::jump_if_false:
+          if (!acc)
+            pc = op.jump - 1;
+          break;
+        case Filter_code::jump_if_true:
+          if (acc)
+            pc = op.jump - 1;
+          break;
+        case Filter_code::negate:
+          acc = !acc;
+          break;
+        case Filter_code::compare_int:
+          if (op.direct)
+            acc = compare(load_int(flat + op.offset, op.bytes, op.sign), op.i, op.cmp);
+          else
+          {
+            Dyn_value v = get(*op.plan, flat);
+            acc = v.is_present() && compare(v.to_int(), op.i, op.cmp);
+          }
+          break;
+        case Filter_code::compare_double:
+          if (op.direct)
+            acc = compare(load_double(flat + op.offset, op.bytes, op.sign, op.floating), op.d, op.cmp);
+          else
+          {
+            Dyn_value v = get(*op.plan, flat);
+            acc = v.is_present() && compare(v.to_double(), op.d, op.cmp);
+          }
+          break;
+        case Filter_code::compare_string:
+        {
+          Dyn_value v = get(*op.plan, flat);
+          acc = v.is_present() && compare(v.to_string(), std::string_view{strings[op.str]}, op.cmp);
+          break;
+        }
+      }
+    }
+    return acc;
+  }
+
+  int evaluate(std::span<Byte* const> flats, std::span<bool> result) const
+  // result[i] = (*this)(flats[i]); return the number that passed
+  {
+    expect([&] { return flats.size() <= result.size(); }, Error_code::bad_span_index);
+    int passed = 0;
+    for (std::size_t i = 0; i != flats.size(); ++i)
+      passed += result[i] = (*this)(flats[i]);
+    return passed;
+  }
+
+  int select(std::span<Byte* const> flats, std::vector<int>& passed) const
+  // append the indices of the flats that pass to passed; return how many did
+  {
+    std::size_t n = passed.size();
+    for (std::size_t i = 0; i != flats.size(); ++i)
+      if ((*this)(flats[i]))
+        passed.push_back(static_cast<int>(i));
+    return static_cast<int>(passed.size() - n);
+  }
+
+  const std::vector<Filter_op>& operations() const
+  {
+    return code;
+  }
+
+private:
+  template <class T>
+  static bool compare(const T& a, const T& b, Compare c)
+  {
+    switch (c)
+    {
+      case Compare::eq:
+        return a == b;
+      case Compare::ne:
+        return a != b;
+      case Compare::lt:
+        return a < b;
+      case Compare::le:
+        return a <= b;
+      case Compare::gt:
+        return a > b;
+      case Compare::ge:
+        return a >= b;
+    }
+    return false;
+  }
+
+  template <class T>
+  static T load(Byte* p)
+  {
+    return Unaligned<Wire_t<T>>{p};
+  }
+
+  static std::int64_t load_int(Byte* p, int bytes, bool sign)
+  {
+    switch (bytes)
+    {
+      case 1:
+        return sign ? std::int64_t(load<std::int8_t>(p)) : std::int64_t(load<std::uint8_t>(p));
+      case 2:
+        return sign ? std::int64_t(load<std::int16_t>(p)) : std::int64_t(load<std::uint16_t>(p));
+      case 4:
+        return sign ? std::int64_t(load<std::int32_t>(p)) : std::int64_t(load<std::uint32_t>(p));
+      default:
+        return load<std::int64_t>(p);
+    }
+  }
+
+  static double load_double(Byte* p, int bytes, bool sign, bool floating)
+  {
+    if (!floating)
+      return double(load_int(p, bytes, sign));
+    return bytes == 4 ? double(load<float>(p)) : load<double>(p);
+  }
+
+  // parsing: recursive descent, emitting operations as it goes
+
+  void skip()
+  {
+    while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+      ++pos;
+  }
+
+  bool next_is(std::string_view s)
+  // consume s if it is next
+  {
+    skip();
+    if (text.substr(pos, s.size()) != s)
+      return false;
+    pos += s.size();
+    return true;
+  }
+
+  void fail()
+  {
+    failed = true;
+    expect([] { return false; }, Error_code::bad_filter);
+  }
+
+  void parse_or()
+  {
+    parse_and();
+    std::vector<int> jumps; // to the end of the ||s
+    while (next_is("||"))
+    {
+      jumps.push_back(emit({Filter_code::jump_if_true}));
+      parse_and();
+    }
+    for (int j : jumps)
+      code[j].jump = static_cast<int>(code.size());
+  }
+
+  void parse_and()
+  {
+    parse_not();
+    std::vector<int> jumps; // to the end of the &&s
+    while (next_is("&&"))
+    {
+      jumps.push_back(emit({Filter_code::jump_if_false}));
+      parse_not();
+    }
+    for (int j : jumps)
+      code[j].jump = static_cast<int>(code.size());
+  }
+
+  void parse_not()
+  {
+    if (next_is("!"))
+    {
+      parse_not();
+      emit({Filter_code::negate});
+      return;
+    }
+    if (next_is("("))
+    {
+      parse_or();
+      if (!next_is(")"))
+        fail();
+      return;
+    }
+    parse_comparison();
+  }
+
+  void parse_comparison()
+  {
+    skip();
+    std::size_t start = pos;
+    while (pos < text.size()
+      && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_' || text[pos] == '.' || text[pos] == '['
+        || text[pos] == ']'))
+      ++pos;
+    if (pos == start)
+      return fail();
+    const Access_plan& plan = schema.plan(root, prefix + std::string{text.substr(start, pos - start)});
+    if (plan.type == Dyn_type::absent)
+      return fail(); // no such field
+    if (plan.indices)
+      return fail(); // no indices to give
+
+    Filter_op op{Filter_code::compare_int};
+    static constexpr std::pair<std::string_view, Compare> ops[] = {{"==", Compare::eq}, {"!=", Compare::ne},
+      {"<=", Compare::le}, {">=", Compare::ge}, {"<", Compare::lt}, {">", Compare::gt}};
+    bool found = false;
+    for (auto& [s, c] : ops)
+      if (next_is(s))
+      {
+        op.cmp = c;
+        found = true;
+        break;
+      }
+    if (!found)
+      return fail();
+
+    op.plan = &plan;
+    if (plan.steps.empty() || (plan.steps.size() == 1 && plan.steps[0].op == Access_op::add))
+    { // a number in the flat itself (or a flat nested in it)
+      op.direct = true;
+      op.offset = plan.steps.empty() ? 0 : plan.steps[0].offset;
+      op.bytes = plan.bytes;
+      op.sign = plan.type != Dyn_type::unsigned_integer;
+    }
+    bool text_field = plan.type == Dyn_type::string || (plan.type == Dyn_type::array && plan.element == Dyn_type::character);
+    bool number_field = plan.type == Dyn_type::integer || plan.type == Dyn_type::unsigned_integer
+      || plan.type == Dyn_type::character || plan.type == Dyn_type::floating;
+
+    skip();
+    if (pos < text.size() && text[pos] == '"')
+    { // "string"
+      auto end = text.find('"', pos + 1);
+      if (end == std::string_view::npos || !text_field)
+        return fail();
+      op.code = Filter_code::compare_string;
+      op.direct = false;
+      op.str = static_cast<int>(strings.size());
+      strings.emplace_back(text.substr(pos + 1, end - pos - 1));
+      pos = end + 1;
+    }
+    else if (pos + 2 < text.size() && text[pos] == '\'' && text[pos + 2] == '\'')
+    { // 'c'
+      if (!number_field || plan.type == Dyn_type::floating)
+        return fail();
+      op.i = static_cast<unsigned char>(text[pos + 1]);
+      pos += 3;
+    }
+    else
+    { // a number
+      if (pos + 1 < text.size() && text[pos] == '+' && text[pos + 1] != '-')
+        ++pos; // from_chars() takes no '+'
+      std::size_t start = pos;
+      if (pos < text.size() && text[pos] == '-')
+        ++pos;
+      bool fraction = false;
+      while (pos < text.size()
+        && (std::isdigit(static_cast<unsigned char>(text[pos])) || text[pos] == '.' || text[pos] == 'e' || text[pos] == 'E'))
+        if (!std::isdigit(static_cast<unsigned char>(text[pos++])))
+        {
+          fraction = true;
+          if ((text[pos - 1] == 'e' || text[pos - 1] == 'E') && pos < text.size() && (text[pos] == '-' || text[pos] == '+'))
+            ++pos; // the sign of the exponent
+        }
+      std::string_view lit = text.substr(start, pos - start);
+      if (lit.empty() || !number_field)
+        return fail();
+      const char* first = lit.data();
+      const char* last = first + lit.size();
+      std::from_chars_result r;
+      if (fraction || plan.type == Dyn_type::floating)
+      {
+        op.code = Filter_code::compare_double;
+        r = std::from_chars(first, last, op.d);
+        op.floating = plan.type == Dyn_type::floating;
+      }
+      else
+        r = std::from_chars(first, last, op.i);
+      if (r.ec != std::errc{} || r.ptr != last)
+        return fail(); // e.g., "-" or out of range
+    }
+    emit(op);
+  }
+
+  int emit(const Filter_op& op)
+  {
+    code.push_back(op);
+    return static_cast<int>(code.size()) - 1;
+  }
+
+  Dynamic_schema& schema;
+  std::string root;
+  std::string prefix; // "flat." for a message
+  std::string_view text; // only while compiling
+  std::size_t pos = 0;
+  std::vector<Filter_op> code;
+  std::vector<std::string> strings;
+  bool failed = false; // the expression didn't compile; the error policy didn't stop us
+};
+
+} // inline namespace FLATS_POLICY
+} // namespace Flats
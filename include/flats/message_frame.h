@@ -0,0 +1,288 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0.
+
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+#pragma once
+/*
+	Frames: many messages, of one type or several, back to back in one buffer,
+	so that one send() or one ring commit carries them all
+
+	Layout:
+		Frame_header	magic, count, size, and where the index is
+		messages	each at a multiple of its alignment (at least frame_align) from the start of the frame
+		index		a Frame_entry (offset, type) per message, in order
+	The header and index use the wire byte order (see Wire in flat_types.h), as messages do.
+	The types are the application's: any 32-bit codes that tell the reader which message it is looking at.
+
+	Writer (buf must be aligned as the most aligned message; 8 bytes will do for most):
+		Frame_builder b{ buf, buf_size };
+		b.add(trade_code, *m);			// copy a message that has been built elsewhere
+		auto q = b.place<Quote>(quote_code, 64);	// or build it in place, with a 64 byte tail
+		q->direct().price(1.5);
+		int n = b.finish();			// the frame is buf[0:n)
+
+	A placed message keeps the whole of its tail only until the next add(), place(), or finish():
+	then it is shrunk to what it uses, so placing costs no more space than copying.
+
+	Reader (in place, no copying):
+		for (Frame_message x : Frame_reader{ buf, n })
+			if (x.type == quote_code)
+				use(x.as<Quote>()->direct());
+	The Frame_reader checks the header and index; use the generated verify_M() on x.data[0:x.size)
+	before trusting the contents of a message from an untrusted source.
+*/
+
+#include "flat_types.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace Flats
+{
+inline namespace FLATS_POLICY
+{
+
+constexpr int frame_align = 8; // the minimum alignment of a message in a frame
+
+struct Frame_header
+{
+  Wire_t<std::uint32_t> magic;
+  Wire_t<std::uint32_t> count; // messages
+  Wire_t<std::uint32_t> size; // bytes in the frame, including the header and index
+  Wire_t<std::uint32_t> index; // offset of the index
+};
+
+struct Frame_entry
+{
+  Wire_t<std::uint32_t> offset; // of the message from the start of the frame
+  Wire_t<std::uint32_t> type;
+};
+
+constexpr std::uint32_t frame_magic = 0x464c5442; // "FLTB"
+
+class Frame_builder
+{
+public:
+  Frame_builder(Byte* buf, int size)
+  {
+    start(buf, size);
+  }
+
+  void start(Byte* buf, int size)
+  // begin a new frame in buf[0:size); the index's capacity is kept for reuse
+  {
+    expect([&] { return static_cast<int>(sizeof(Frame_header)) <= size; }, Error_code::small_buffer);
+    base = buf;
+    max = size;
+    next = sizeof(Frame_header);
+    entries.clear();
+    placed = nullptr;
+  }
+
+  template <class M>
+  M* add(std::uint32_t type, const M& m)
+  // a copy of m, shrunk to its wire_size()
+  {
+    Byte* p = allocate<M>(type, m.wire_size());
+    if (!p)
+      return nullptr; // the error policy didn't stop us
+    return m.clone(p);
+  }
+
+  template <class M>
+  M* place(std::uint32_t type, int size_of_tail)
+  // a new M to be built in place, with room for size_of_tail bytes of tail
+  {
+    Byte* p = allocate<M>(type, sizeof(M) + sizeof(typename M::Flat) + size_of_tail);
+    if (!p)
+      return nullptr; // the error policy didn't stop us
+    M* m = new (p) M{max - static_cast<int>(p - base), size_of_tail};
+    placed = p;
+    shrink = [](Byte* q) {
+      auto mm = reinterpret_cast<M*>(q);
+      mm->shrink_to_fit();
+      return mm->current_size();
+    };
+    return m;
+  }
+
+  int count() const
+  {
+    return static_cast<int>(entries.size());
+  }
+
+  int finish()
+  // write the index and header; return the size of the frame, or 0 if the index doesn't fit
+  {
+    trim();
+    int index = round_up(next, alignof(Frame_entry));
+    int size = index + count() * static_cast<int>(sizeof(Frame_entry));
+    expect([&] { return size <= max; }, Error_code::small_buffer);
+    if (max < size)
+      return 0; // the error policy didn't stop us
+    kernels::copy_bytes(base + index, entries.data(), entries.size() * sizeof(Frame_entry));
+    auto h = new (base) Frame_header{};
+    h->magic = frame_magic;
+    h->count = static_cast<std::uint32_t>(count());
+    h->size = static_cast<std::uint32_t>(size);
+    h->index = static_cast<std::uint32_t>(index);
+    return size;
+  }
+
+private:
+  static int round_up(int n, int a)
+  {
+    return (n + a - 1) / a * a;
+  }
+
+  void trim()
+  // give back the unused tail of the last placed message
+  {
+    if (placed)
+      next = static_cast<int>(placed - base) + shrink(placed);
+    placed = nullptr;
+  }
+
+  template <class M>
+  Byte* allocate(std::uint32_t type, int n)
+  // room for n bytes, recorded in the index; nullptr if they don't fit
+  {
+    trim();
+    constexpr int a = std::max({frame_align, static_cast<int>(alignof(M)), static_cast<int>(alignof(typename M::Flat))});
+    int offset = round_up(next, a);
+    expect([&] { return offset + n <= max; }, Error_code::small_buffer);
+    if (max < offset + n)
+      return nullptr; // the error policy didn't stop us
+    entries.push_back(Frame_entry{});
+    entries.back().offset = static_cast<std::uint32_t>(offset);
+    entries.back().type = type;
+    next = offset + n;
+    return base + offset;
+  }
+
+  Byte* base = nullptr;
+  int max = 0; // size of the buffer
+  int next = 0; // the first free byte
+  std::vector<Frame_entry> entries;
+  Byte* placed = nullptr; // the last placed message, until it has been trimmed
+  int (*shrink)(Byte*) = nullptr; // for placed
+};
+
+struct Frame_message
+{
+  std::uint32_t type;
+  Byte* data;
+  int size; // bytes up to the next message: the message and any padding
+
+  template <class M>
+  M* as() const
+  // the message, with its header checked against size, as a generated place_M_reader() would
+  {
+    auto m = reinterpret_cast<M*>(data);
+    bool ok = static_cast<int>(sizeof(M) + sizeof(typename M::Flat)) <= size;
+    if constexpr (requires { m->alloc; }) // a message without a tail has no Allocator
+      ok = ok && m->alloc.next <= m->alloc.max;
+    expect([&] { return ok && m->current_size() <= size; }, Error_code::bad_message);
+    return m;
+  }
+};
+
+class Frame_reader
+{
+public:
+  Frame_reader() = default; // no messages
+
+  Frame_reader(Byte* buf, int len)
+  // check the header and the index of the frame in buf[0:len)
+    : base{buf}
+  {
+    bool ok = static_cast<int>(sizeof(Frame_header)) <= len;
+    expect([&] { return ok; }, Error_code::bad_message);
+    if (!ok)
+      return; // no messages, whatever the error policy
+    auto h = reinterpret_cast<const Frame_header*>(buf);
+    std::uint32_t n = h->count;
+    std::uint32_t size = h->size;
+    std::uint32_t index = h->index;
+    ok = h->magic == frame_magic && size <= static_cast<std::uint32_t>(len) && sizeof(Frame_header) <= index
+      && index <= size && index % alignof(Frame_entry) == 0 && n <= (size - index) / sizeof(Frame_entry);
+    auto e = reinterpret_cast<const Frame_entry*>(buf + index);
+    std::uint32_t prev = sizeof(Frame_header);
+    for (std::uint32_t i = 0; ok && i != n; ++i)
+    { // in order, and inside the frame
+      std::uint32_t off = e[i].offset;
+      ok = prev <= off && off < index && off % frame_align == 0;
+      prev = off;
+    }
+    expect([&] { return ok; }, Error_code::bad_message);
+    if (!ok)
+      return;
+    entries = e;
+    count = static_cast<int>(n);
+    end_of_messages = index;
+  }
+
+  int size() const // messages
+  {
+    return count;
+  }
+
+  Frame_message operator[](int i) const
+  {
+    expect([&] { return 0 <= i && i < count; }, Error_code::bad_span_index);
+    return get(i);
+  }
+
+  struct Iterator
+  {
+    const Frame_reader* r;
+    int i;
+
+    Frame_message operator*() const
+    {
+      return r->get(i);
+    }
+    Iterator& operator++()
+    {
+      ++i;
+      return *this;
+    }
+    bool operator==(const Iterator&) const = default;
+  };
+
+  Iterator begin() const
+  {
+    return {this, 0};
+  }
+
+  Iterator end() const
+  {
+    return {this, count};
+  }
+
+private:
+  Frame_message get(int i) const
+  {
+    std::uint32_t off = entries[i].offset;
+    std::uint32_t last = (i + 1 == count) ? end_of_messages : static_cast<std::uint32_t>(entries[i + 1].offset);
+    return {entries[i].type, base + off, static_cast<int>(last - off)};
+  }
+
+  Byte* base = nullptr;
+  const Frame_entry* entries = nullptr;
+  int count = 0;
+  std::uint32_t end_of_messages = 0; // the index
+};
+
+} // inline namespace FLATS_POLICY
+} // namespace Flats
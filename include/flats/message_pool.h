@@ -0,0 +1,164 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0.
+
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+#pragma once
+/*
+	Message_pool: recycled buffers for messages
+
+	A message needs sizeof(M) + sizeof(M::Flat) + size_of_tail bytes.
+	Buffers come in power-of-two size classes; each class has two free lists:
+		a private list used only by the thread that acquires (no synchronization), and
+		a lock-free list that any thread can release to.
+	When the private list runs dry, the acquiring thread takes the whole released list with one exchange.
+	Only one thread takes from the released list, so there is no ABA problem.
+	Every buffer is aligned to the pool's alignment (by default a cache line), enough for "flat align 64".
+
+	Use:
+		Message_pool pool;
+		M* m = acquire_M(pool, 1024);	// generated: an already placed M with a 1024 byte tail
+		// ... fill and send m ...
+		release(m);	// from any thread
+
+	Restrictions:
+		one thread acquires; any number of threads release
+		the pool must outlive every message acquired from it
+*/
+
+#include "flat_types.h"
+#include <atomic>
+#include <bit>
+#include <new>
+#include <vector>
+
+namespace Flats
+{
+inline namespace FLATS_POLICY
+{
+
+class Message_pool
+{
+public:
+  static constexpr int min_class = 6; // 64 bytes
+  static constexpr int max_class = 30; // 1GB
+
+  explicit Message_pool(int chunk_size = 64 * 1024, int alignment = 64)
+  // alignment: of every buffer; a power of two
+    : chunk{chunk_size}, align{alignment}
+  {
+    expect([&] { return static_cast<int>(alignof(Header)) <= align && std::has_single_bit(static_cast<unsigned>(align)); },
+      Error_code::misaligned);
+    if (align < static_cast<int>(alignof(Header)) || !std::has_single_bit(static_cast<unsigned>(align)))
+      align = alignof(Header);
+  }
+
+  Message_pool(const Message_pool&) = delete;
+  Message_pool& operator=(const Message_pool&) = delete;
+
+  ~Message_pool()
+  {
+    for (Byte* p : chunks)
+      ::operator delete(p, std::align_val_t{static_cast<std::size_t>(align)});
+  }
+
+  int alignment() const
+  {
+    return align;
+  }
+
+  Byte* acquire(int size, int alignment = alignof(std::max_align_t))
+  // a buffer of at least size bytes, aligned to alignment; call from the acquiring thread only
+  {
+    expect([&] { return 0 < size && size <= capacity(max_class); }, Error_code::bad_int);
+    expect([&] { return alignment <= align; }, Error_code::misaligned);
+    if (size <= 0 || capacity(max_class) < size || align < alignment)
+      return nullptr; // the error policy didn't stop us
+    int cls = size_class(size);
+    Free_list& fl = classes[cls];
+    if (fl.local == nullptr)
+      fl.local = fl.released.exchange(nullptr, std::memory_order_acquire);
+    if (fl.local == nullptr)
+      refill(cls);
+    Header* h = fl.local;
+    fl.local = h->next;
+    return reinterpret_cast<Byte*>(h + 1);
+  }
+
+  static void release(Byte* p)
+  // return a buffer obtained from acquire(); call from any thread
+  {
+    Header* h = reinterpret_cast<Header*>(p) - 1;
+    auto& head = h->pool->classes[h->cls].released;
+    Header* old = head.load(std::memory_order_relaxed);
+    do
+      h->next = old;
+    while (!head.compare_exchange_weak(old, h, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  static int size_class(int size)
+  // 0 < size <= capacity(max_class)
+  {
+    int cls = std::bit_width(static_cast<unsigned>(size - 1));
+    return (cls < min_class) ? min_class : cls;
+  }
+
+  static int capacity(int cls)
+  {
+    return 1 << cls;
+  }
+
+private:
+  struct alignas(std::max_align_t) Header
+  { // immediately precedes every buffer
+    Header* next;
+    Message_pool* pool;
+    int cls;
+  };
+
+  struct Free_list
+  { // keep the releasing threads' cache line away from the acquiring thread's
+    alignas(64) Header* local = nullptr;
+    alignas(64) std::atomic<Header*> released{nullptr};
+  };
+
+  void refill(int cls)
+  // allocate a chunk of buffers for size class cls
+  {
+    std::size_t a = align;
+    std::size_t room = (sizeof(Header) + a - 1) / a * a; // before each buffer, ending with its Header
+    std::size_t block = (room + capacity(cls) + a - 1) / a * a;
+    std::size_t n = (block < static_cast<std::size_t>(chunk)) ? chunk / block : 1;
+    Byte* p = static_cast<Byte*>(::operator new(n * block, std::align_val_t{a}));
+    chunks.push_back(p);
+    for (std::size_t i = 0; i != n; ++i)
+    {
+      Header* h = new (p + i * block + room - sizeof(Header)) Header{classes[cls].local, this, cls};
+      classes[cls].local = h;
+    }
+  }
+
+  int chunk; // bytes allocated at a time per size class
+  int align; // of every buffer
+  Free_list classes[max_class + 1];
+  std::vector<Byte*> chunks;
+};
+
+template <class M>
+void release(M* m)
+// return a message obtained from a generated acquire_M() to its pool
+{
+  Message_pool::release(reinterpret_cast<Byte*>(m));
+}
+
+} // inline namespace FLATS_POLICY
+} // namespace Flats
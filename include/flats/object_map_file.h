@@ -0,0 +1,150 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0.
+
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+#pragma once
+/*
+	Binary object maps: the layouts of the flats of a schema, for programs that discover layouts at run time
+
+	"flats obj_map_binary schema.flat schema.map" writes a frame (see message_frame.h) holding an Obj_map message
+	per flat, variant, and message, in order of name. Obj_map is a message of the flat Flat_map (see object_map.flat):
+		Flat_map: name, version, bytes (sizeof), align, type_id (flat, variant, message), and fields
+		Field_map: index, offset, bytes, count, type_id, name, and type_name of a field
+	A variant's fields are its alternatives; a message's one field, "flat", is its flat, after the message header.
+	so a map is read with the ordinary generated accessors:
+
+		Object_map_file f{ "schema.map" };	// mmap(); checks the frame and verifies each map, doesn't copy
+		if (Obj_map* m = f.find("Mess"))
+			for (auto fld : m->direct().fields())
+				use(fld.name(), fld.offset());
+
+	find() is a binary search over the index of the frame.
+	The file must have been written by a generator with the layout width and wire byte order of the reader:
+	the frame's type code says which layout width it was written with.
+	The file is mapped copy-on-write: writes through the accessors change this process's view of it only.
+*/
+
+#include "flat_types.h"
+#include "message_frame.h"
+#include "object_map_flat.h"
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Flats
+{
+inline namespace FLATS_POLICY
+{
+
+constexpr std::uint32_t object_map_type = 0x4f4d0000 + layout_width; // "OM" and the layout width
+
+inline std::string_view name_of(Obj_map* m)
+{
+  auto s = m->direct().name();
+  return {s.begin(), static_cast<std::size_t>(s.size())};
+}
+
+class Object_map_file
+{
+public:
+  explicit Object_map_file(const char* path)
+  {
+    int fd = ::open(path, O_RDONLY);
+    expect([&] { return fd != -1; }, Error_code::file_error);
+    struct stat st;
+    bool ok = ::fstat(fd, &st) == 0;
+    if (ok)
+    {
+      bytes = st.st_size;
+      void* p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      ok = p != MAP_FAILED;
+      if (ok)
+        base = static_cast<Byte*>(p);
+    }
+    ::close(fd);
+    expect([&] { return ok; }, Error_code::file_error);
+    Frame_reader r = ok ? Frame_reader{base, static_cast<int>(bytes)} : Frame_reader{};
+    bool good = true; // the file is from disk: check every Offset before find() follows any
+    for (Frame_message x : r)
+      good = good && x.type == object_map_type && verify_Obj_map(x.data, x.size).ok;
+    expect([&] { return good; }, Error_code::bad_message);
+    if (good)
+      frame = r; // else no maps, whatever the error policy
+  }
+
+  Object_map_file(Object_map_file&& f) noexcept
+  {
+    swap(f);
+  }
+
+  Object_map_file& operator=(Object_map_file&& f) noexcept
+  {
+    swap(f);
+    return *this;
+  }
+
+  ~Object_map_file()
+  {
+    if (base)
+      ::munmap(base, bytes);
+  }
+
+  int size() const // flats
+  {
+    return frame.size();
+  }
+
+  Obj_map* operator[](int i) const
+  {
+    return frame[i].as<Obj_map>();
+  }
+
+  Obj_map* find(std::string_view name) const
+  // the map of the flat called name, or nullptr
+  {
+    int lo = 0;
+    int hi = size();
+    while (lo < hi)
+    {
+      int mid = lo + (hi - lo) / 2;
+      Obj_map* m = (*this)[mid];
+      auto n = name_of(m);
+      if (n == name)
+        return m;
+      if (n < name)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return nullptr;
+  }
+
+private:
+  void swap(Object_map_file& f) noexcept
+  {
+    std::swap(base, f.base);
+    std::swap(bytes, f.bytes);
+    std::swap(frame, f.frame);
+  }
+
+  Byte* base = nullptr;
+  std::size_t bytes = 0; // mapped
+  Frame_reader frame;
+};
+
+} // inline namespace FLATS_POLICY
+} // namespace Flats
@@ -0,0 +1,973 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0.
+
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+// Generated from object_map.flat by "flats direct object_map.flat object_map_flat.h"; don't edit.
+// Generated twice: by a parser built with FLATS_WIDE_LAYOUT for the first part, and without it for the second.
+// #include object_map_file.h rather than this.
+
+#pragma once
+#include<cstdint>
+#ifdef FLATS_WIDE_LAYOUT
+namespace Flats { inline namespace FLATS_POLICY {
+
+
+// struct (memory layout):
+struct Field_map{
+   Field_map(){}
+   std::int32_t index;
+   std::int32_t offset;
+   std::int32_t bytes;
+   std::int32_t count;
+   std::int16_t type_id;
+   String name;
+   String type_name;
+};
+
+inline bool verify(const Field_map& x, Verifier& v)
+{
+   return v.check(x.name)
+      && v.check(x.type_name);
+}
+
+
+
+// Flat direct accessors:
+// options: initializer check==0 default initialization==1
+
+   struct Field_map_message;
+struct Field_map_direct {
+   Field_map* mbuf;
+   constexpr static bool flat_tag = true;
+   Allocator* allo;
+   Field_map_direct(Field_map* pp, Allocator* a) :mbuf{pp}, allo{a} {}
+   std::int32_t& index() {  return mbuf->index; }
+   void index(std::int32_t arg) { new(&mbuf->index) std::int32_t(arg); }
+
+   std::int32_t& offset() {  return mbuf->offset; }
+   void offset(std::int32_t arg) { new(&mbuf->offset) std::int32_t(arg); }
+
+   std::int32_t& bytes() {  return mbuf->bytes; }
+   void bytes(std::int32_t arg) { new(&mbuf->bytes) std::int32_t(arg); }
+
+   std::int32_t& count() {  return mbuf->count; }
+   void count(std::int32_t arg) { new(&mbuf->count) std::int32_t(arg); }
+
+   std::int16_t& type_id() {  return mbuf->type_id; }
+   void type_id(std::int16_t arg) { new(&mbuf->type_id) std::int16_t(arg); }
+
+   Span<char> name() {  return mbuf->name; }
+   void name(const char* arg) { new(&mbuf->name) String(allo,arg); }
+   void name(const std::string&  arg) { new(&mbuf->name) String(allo,arg); }
+   void name(Extent arg) { new(&mbuf->name) String(allo,arg); }
+   void name(Push) { mbuf->name.push(allo); }
+   template<class Arg> void name(Push, Arg arg) { mbuf->name.push(allo, arg); }
+   auto name(Reserve, Extent n) { return mbuf->name.reserve(allo, n); }
+   void name(Append, std::span<const char> arg) { mbuf->name.append(allo, arg); }
+
+   Span<char> type_name() {  return mbuf->type_name; }
+   void type_name(const char* arg) { new(&mbuf->type_name) String(allo,arg); }
+   void type_name(const std::string&  arg) { new(&mbuf->type_name) String(allo,arg); }
+   void type_name(Extent arg) { new(&mbuf->type_name) String(allo,arg); }
+   void type_name(Push) { mbuf->type_name.push(allo); }
+   template<class Arg> void type_name(Push, Arg arg) { mbuf->type_name.push(allo, arg); }
+   auto type_name(Reserve, Extent n) { return mbuf->type_name.reserve(allo, n); }
+   void type_name(Append, std::span<const char> arg) { mbuf->type_name.append(allo, arg); }
+
+};
+
+class Field_map_unchecked {
+public:
+   std::int32_t& index() { return mbuf->index; }
+   std::int32_t& offset() { return mbuf->offset; }
+   std::int32_t& bytes() { return mbuf->bytes; }
+   std::int32_t& count() { return mbuf->count; }
+   std::int16_t& type_id() { return mbuf->type_id; }
+   Unchecked_span<char> name() { auto& x = mbuf->name; return {x.begin(), x.end()}; }
+   Unchecked_span<char> type_name() { auto& x = mbuf->type_name; return {x.begin(), x.end()}; }
+private:
+   Field_map_unchecked(Field_map* p) :mbuf{p} {}
+   Field_map* mbuf;
+   template<class T, class TU> friend struct Unchecked_span_ref;
+   template<class T, class TU> friend struct Unchecked_optional_ref;
+};
+
+class Field_map_batch {
+public:
+   void append(const Field_map_direct& d) {
+      auto& f = *d.mbuf;
+      cols.index.push_back(f.index);
+      cols.offset.push_back(f.offset);
+      cols.bytes.push_back(f.bytes);
+      cols.count.push_back(f.count);
+      cols.type_id.push_back(f.type_id);
+      cols.name.append(f.name.begin(), f.name.end());
+      cols.type_name.append(f.type_name.begin(), f.type_name.end());
+      ++rows;
+   }
+   std::size_t size() const { return rows; }
+   void reserve(std::size_t n) { cols.index.reserve(n); cols.offset.reserve(n); cols.bytes.reserve(n); cols.count.reserve(n); cols.type_id.reserve(n); cols.name.reserve(n); cols.type_name.reserve(n); }
+   void clear() { cols.index.clear(); cols.offset.clear(); cols.bytes.clear(); cols.count.clear(); cols.type_id.clear(); cols.name.clear(); cols.type_name.clear(); rows = 0; }
+
+   std::span<std::int32_t> index() { return cols.index; }
+   std::span<const std::int32_t> index() const { return cols.index; }
+   std::span<std::int32_t> offset() { return cols.offset; }
+   std::span<const std::int32_t> offset() const { return cols.offset; }
+   std::span<std::int32_t> bytes() { return cols.bytes; }
+   std::span<const std::int32_t> bytes() const { return cols.bytes; }
+   std::span<std::int32_t> count() { return cols.count; }
+   std::span<const std::int32_t> count() const { return cols.count; }
+   std::span<std::int16_t> type_id() { return cols.type_id; }
+   std::span<const std::int16_t> type_id() const { return cols.type_id; }
+   Ragged_column<char>& name() { return cols.name; }
+   const Ragged_column<char>& name() const { return cols.name; }
+   Ragged_column<char>& type_name() { return cols.type_name; }
+   const Ragged_column<char>& type_name() const { return cols.type_name; }
+private:
+   std::size_t rows = 0;
+   struct {
+      std::vector<std::int32_t> index;
+      std::vector<std::int32_t> offset;
+      std::vector<std::int32_t> bytes;
+      std::vector<std::int32_t> count;
+      std::vector<std::int16_t> type_id;
+      Ragged_column<char> name;
+      Ragged_column<char> type_name;
+   } cols;
+};
+
+} } // namespace Flats
+
+namespace Flats { inline namespace FLATS_POLICY {
+
+
+// struct (memory layout):
+struct Flat_map{
+   Flat_map(){}
+   String name;
+   std::int32_t version;
+   std::int32_t bytes;
+   std::int32_t align;
+   std::int16_t type_id;
+   Vector<Field_map> fields;
+};
+
+inline bool verify(const Flat_map& x, Verifier& v)
+{
+   return v.check(x.name)
+      && v.check(x.fields);
+}
+
+
+
+// Flat direct accessors:
+// options: initializer check==0 default initialization==1
+
+   struct Flat_map_message;
+struct Flat_map_direct {
+   Flat_map* mbuf;
+   constexpr static bool flat_tag = true;
+   Allocator* allo;
+   Flat_map_direct(Flat_map* pp, Allocator* a) :mbuf{pp}, allo{a} {}
+   Span<char> name() {  return mbuf->name; }
+   void name(const char* arg) { new(&mbuf->name) String(allo,arg); }
+   void name(const std::string&  arg) { new(&mbuf->name) String(allo,arg); }
+   void name(Extent arg) { new(&mbuf->name) String(allo,arg); }
+   void name(Push) { mbuf->name.push(allo); }
+   template<class Arg> void name(Push, Arg arg) { mbuf->name.push(allo, arg); }
+   auto name(Reserve, Extent n) { return mbuf->name.reserve(allo, n); }
+   void name(Append, std::span<const char> arg) { mbuf->name.append(allo, arg); }
+
+   std::int32_t& version() {  return mbuf->version; }
+   void version(std::int32_t arg) { new(&mbuf->version) std::int32_t(arg); }
+
+   std::int32_t& bytes() {  return mbuf->bytes; }
+   void bytes(std::int32_t arg) { new(&mbuf->bytes) std::int32_t(arg); }
+
+   std::int32_t& align() {  return mbuf->align; }
+   void align(std::int32_t arg) { new(&mbuf->align) std::int32_t(arg); }
+
+   std::int16_t& type_id() {  return mbuf->type_id; }
+   void type_id(std::int16_t arg) { new(&mbuf->type_id) std::int16_t(arg); }
+
+   auto fields() {  return Span_ref<Field_map, Field_map_direct>{mbuf->fields.begin(), mbuf->fields.end(), allo}; }
+   void fields(Extent arg) { new(&mbuf->fields) Vector<Field_map>(allo,arg); }
+   void fields(Push) { mbuf->fields.push(allo); }
+   template<class Arg> void fields(Push, Arg arg) { mbuf->fields.push(allo, arg); }
+
+};
+
+class Flat_map_unchecked {
+public:
+   Unchecked_span<char> name() { auto& x = mbuf->name; return {x.begin(), x.end()}; }
+   std::int32_t& version() { return mbuf->version; }
+   std::int32_t& bytes() { return mbuf->bytes; }
+   std::int32_t& align() { return mbuf->align; }
+   std::int16_t& type_id() { return mbuf->type_id; }
+   Unchecked_span_ref<Field_map, Field_map_unchecked> fields() { auto& x = mbuf->fields; return {x.begin(), x.end()}; }
+private:
+   Flat_map_unchecked(Flat_map* p) :mbuf{p} {}
+   Flat_map* mbuf;
+   friend class Obj_map_verified;
+};
+
+class Flat_map_batch {
+public:
+   void append(const Flat_map_direct& d) {
+      auto& f = *d.mbuf;
+      cols.version.push_back(f.version);
+      cols.bytes.push_back(f.bytes);
+      cols.align.push_back(f.align);
+      cols.type_id.push_back(f.type_id);
+      cols.name.append(f.name.begin(), f.name.end());
+      ++rows;
+   }
+   std::size_t size() const { return rows; }
+   void reserve(std::size_t n) { cols.version.reserve(n); cols.bytes.reserve(n); cols.align.reserve(n); cols.type_id.reserve(n); cols.name.reserve(n); }
+   void clear() { cols.version.clear(); cols.bytes.clear(); cols.align.clear(); cols.type_id.clear(); cols.name.clear(); rows = 0; }
+
+   std::span<std::int32_t> version() { return cols.version; }
+   std::span<const std::int32_t> version() const { return cols.version; }
+   std::span<std::int32_t> bytes() { return cols.bytes; }
+   std::span<const std::int32_t> bytes() const { return cols.bytes; }
+   std::span<std::int32_t> align() { return cols.align; }
+   std::span<const std::int32_t> align() const { return cols.align; }
+   std::span<std::int16_t> type_id() { return cols.type_id; }
+   std::span<const std::int16_t> type_id() const { return cols.type_id; }
+   Ragged_column<char>& name() { return cols.name; }
+   const Ragged_column<char>& name() const { return cols.name; }
+   // not in the batch: fields
+private:
+   std::size_t rows = 0;
+   struct {
+      std::vector<std::int32_t> version;
+      std::vector<std::int32_t> bytes;
+      std::vector<std::int32_t> align;
+      std::vector<std::int16_t> type_id;
+      Ragged_column<char> name;
+   } cols;
+};
+
+} } // namespace Flats
+
+namespace Flats { inline namespace FLATS_POLICY {
+static_assert(layout_width == 32, "Obj_map was generated for 32-bit Offsets and Sizes");
+struct Obj_map {
+   using Flat = Flat_map;
+   Version v = { 6}; // version is generated
+   Allocator alloc;
+   Obj_map(int buffer_size, int tail_size)
+      :alloc{ size_of<Flat>(),size_of<Flat>() + tail_size }
+      { expect([&] {return static_cast<int>(sizeof(*this)) + alloc.max <=buffer_size; }, Error_code::small_buffer);
+        kernels::zero_bytes(flat(), sizeof(Flat));
+        kernels::zero_bytes(tail(), tail_size);
+      }
+   Obj_map(Zero_fixed_part, int buffer_size, int tail_size)
+      :alloc{ size_of<Flat>(),size_of<Flat>() + tail_size }
+      { expect([&] {return static_cast<int>(sizeof(*this)) + alloc.max <=buffer_size; }, Error_code::small_buffer);
+        kernels::zero_bytes(flat(), sizeof(Flat));
+      }
+   Obj_map(Reader, int buffer_size)
+      { expect([&] {return static_cast<int>(sizeof(*this)) + alloc.next <=buffer_size && alloc.next <= alloc.max; }, Error_code::small_buffer); }
+   Byte* tail() { return reinterpret_cast<Byte*>(flat()) + sizeof(Flat); }
+   int current_size() const { return sizeof(*this) + alloc.next; }
+   int current_capacity() const { return alloc.max - alloc.next; }
+   void shrink_to_fit() { alloc.max = alloc.next; } // no more tail allocation; size() == wire_size()
+   Flat_map_direct direct() { return { flat(), &alloc }; }
+   Obj_map* grow_into(Byte* bigger, int new_size) const { // accessors to the old buffer are invalidated
+      int n = current_size();
+      expect([&] { return n <= new_size; }, Error_code::small_buffer);
+      kernels::copy_bytes(bigger, this, n);
+      kernels::zero_bytes(bigger + n, new_size - n);
+      auto p = reinterpret_cast<Obj_map*>(bigger);
+      p->alloc.max = narrow(new_size - sizeof(*this));
+      return p;
+   }
+   Flat_map* flat() { return reinterpret_cast<Flat_map*>(reinterpret_cast<Byte*>(this) + sizeof(*this)); }
+   int version() const { return v.v; }
+   int size() const { return current_size()+current_capacity(); }
+   int wire_size() const { return current_size(); } // bytes to send or copy; unused tail capacity is not included
+   Obj_map* clone(Byte* p) const {
+      kernels::copy_bytes(p, this, wire_size());
+      auto q = reinterpret_cast<Obj_map*>(p);
+      q->shrink_to_fit();
+      return q;
+   }
+   Obj_map* clone(Byte* p, Stream) const { // for large messages written into memory read elsewhere
+      kernels::stream_copy(p, this, wire_size());
+      auto q = reinterpret_cast<Obj_map*>(p);
+      q->shrink_to_fit();
+      return q;
+   }
+      Obj_map(const Obj_map& arg)
+   {
+      kernels::copy_bytes(this, &arg, arg.wire_size());
+      shrink_to_fit();
+   }
+};
+
+inline Obj_map* place_Obj_map(Byte* buf, int size_of_buffer, int size_of_tail)   { expect_aligned<Obj_map>(buf); return new(buf) Obj_map { size_of_buffer,size_of_tail }; }
+
+inline Obj_map* place_Obj_map(Byte* buf, int size_of_buffer, int size_of_tail, Zero_fixed_part z)   { expect_aligned<Obj_map>(buf); return new(buf) Obj_map { z,size_of_buffer,size_of_tail }; }
+
+inline Obj_map* place_Obj_map_reader(Byte* buf, int size_of_buffer, int )   { return new(buf) Obj_map { Reader{}, size_of_buffer}; }
+
+inline Obj_map* place_Obj_map_writer(Byte* buf, int size_of_buffer, int size_of_tail)   { expect_aligned<Obj_map>(buf); return new(buf) Obj_map { size_of_buffer,size_of_tail }; }
+
+template<class Pool> Obj_map* acquire_Obj_map(Pool& pool, int size_of_tail = 0)
+   { int n = sizeof(Obj_map) + sizeof(Flat_map) + size_of_tail; return place_Obj_map_writer(pool.acquire(n, alignof(Obj_map)), n, size_of_tail); }
+
+inline Verify_result verify_Obj_map(const Byte* buf, int len)
+// check that buf[0:len) holds a well-formed Obj_map before trusting any of it
+{
+   auto m = reinterpret_cast<const Obj_map*>(buf);
+   if (len < static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map))) return {false, Error_code::bad_message, 0};
+   if (m->v.v != 6) return {false, Error_code::bad_version, 0};
+   int next = m->alloc.next;
+   if (next < static_cast<int>(sizeof(Flat_map)) || m->alloc.max < next || len - static_cast<int>(sizeof(Obj_map)) < next)
+      return {false, Error_code::bad_message, static_cast<int>(offsetof(Obj_map, alloc))};
+   Verifier v{buf, buf + sizeof(Obj_map) + sizeof(Flat_map), buf + sizeof(Obj_map) + next};
+   verify(*reinterpret_cast<const Flat_map*>(buf + sizeof(Obj_map)), v);
+   return v.result();
+}
+
+class Obj_map_verified {
+public:
+   bool ok() const { return res.ok; }
+   Verify_result result() const { return res; }
+   Obj_map* message() const { return res.ok ? m : nullptr; }
+   Flat_map_unchecked unchecked() const
+      { expect<Error_handling::terminating>([&] { return res.ok; }, res.error); return {m->flat()}; }
+private:
+   Obj_map_verified(Obj_map* p, Verify_result r) :m{p}, res{r} {}
+   friend Obj_map_verified verified_Obj_map(Byte* buf, int len);
+   Obj_map* m;
+   Verify_result res;
+};
+
+inline Obj_map_verified verified_Obj_map(Byte* buf, int len)
+// verify_Obj_map(buf, len) once, then read through unchecked() without further checks
+   { return { reinterpret_cast<Obj_map*>(buf), verify_Obj_map(buf, len) }; }
+
+// upgrades from earlier versions of Flat_map:
+inline Obj_map* upgrade_Obj_map_v1_to_v6(const Byte* from, int len, Byte* to, int size)
+// the version 1 Obj_map in from[0:len) as a version 6 Obj_map in to[0:size), the rest of which is tail capacity
+// zero: version, bytes, align, type_id, fields
+{
+   auto v = reinterpret_cast<const Version*>(from + 0);
+   auto a = reinterpret_cast<const Allocator*>(from + 4);
+   bool ok = 12 <= len && v->v == 1 && 8 <= a->next && a->next <= a->max && a->next <= len - 12;
+   int tail = ok ? a->next - 8 : 0;
+   expect([&] { return ok; }, Error_code::bad_message);
+   int room = size - static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map));
+   expect([&] { return tail <= room; }, Error_code::small_buffer);
+   if (!ok || room < tail) return nullptr; // the error policy didn't stop us
+   auto m = place_Obj_map(to, size, room, Zero_fixed_part{});
+   const Byte* p = from + 12; // the old flat
+   Byte* q = reinterpret_cast<Byte*>(m->flat());
+   kernels::copy_bytes(q + 0, p + 0, 8); // name
+   kernels::copy_bytes(m->tail(), p + 8, tail);
+   m->alloc.next = narrow(sizeof(Flat_map) + tail);
+   rebase_vector(q + 0, 24); // name
+   return m;
+}
+
+inline Obj_map* upgrade_Obj_map_v2_to_v6(const Byte* from, int len, Byte* to, int size)
+// the version 2 Obj_map in from[0:len) as a version 6 Obj_map in to[0:size), the rest of which is tail capacity
+// zero: bytes, align, type_id, fields
+{
+   auto v = reinterpret_cast<const Version*>(from + 0);
+   auto a = reinterpret_cast<const Allocator*>(from + 4);
+   bool ok = 12 <= len && v->v == 2 && 12 <= a->next && a->next <= a->max && a->next <= len - 12;
+   int tail = ok ? a->next - 12 : 0;
+   expect([&] { return ok; }, Error_code::bad_message);
+   int room = size - static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map));
+   expect([&] { return tail <= room; }, Error_code::small_buffer);
+   if (!ok || room < tail) return nullptr; // the error policy didn't stop us
+   auto m = place_Obj_map(to, size, room, Zero_fixed_part{});
+   const Byte* p = from + 12; // the old flat
+   Byte* q = reinterpret_cast<Byte*>(m->flat());
+   kernels::copy_bytes(q + 0, p + 0, 12); // name, version
+   kernels::copy_bytes(m->tail(), p + 12, tail);
+   m->alloc.next = narrow(sizeof(Flat_map) + tail);
+   rebase_vector(q + 0, 20); // name
+   return m;
+}
+
+inline Obj_map* upgrade_Obj_map_v3_to_v6(const Byte* from, int len, Byte* to, int size)
+// the version 3 Obj_map in from[0:len) as a version 6 Obj_map in to[0:size), the rest of which is tail capacity
+// zero: align, type_id, fields
+{
+   auto v = reinterpret_cast<const Version*>(from + 0);
+   auto a = reinterpret_cast<const Allocator*>(from + 4);
+   bool ok = 12 <= len && v->v == 3 && 16 <= a->next && a->next <= a->max && a->next <= len - 12;
+   int tail = ok ? a->next - 16 : 0;
+   expect([&] { return ok; }, Error_code::bad_message);
+   int room = size - static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map));
+   expect([&] { return tail <= room; }, Error_code::small_buffer);
+   if (!ok || room < tail) return nullptr; // the error policy didn't stop us
+   auto m = place_Obj_map(to, size, room, Zero_fixed_part{});
+   const Byte* p = from + 12; // the old flat
+   Byte* q = reinterpret_cast<Byte*>(m->flat());
+   kernels::copy_bytes(q + 0, p + 0, 16); // name, version, bytes
+   kernels::copy_bytes(m->tail(), p + 16, tail);
+   m->alloc.next = narrow(sizeof(Flat_map) + tail);
+   rebase_vector(q + 0, 16); // name
+   return m;
+}
+
+inline Obj_map* upgrade_Obj_map_v4_to_v6(const Byte* from, int len, Byte* to, int size)
+// the version 4 Obj_map in from[0:len) as a version 6 Obj_map in to[0:size), the rest of which is tail capacity
+// zero: type_id, fields
+{
+   auto v = reinterpret_cast<const Version*>(from + 0);
+   auto a = reinterpret_cast<const Allocator*>(from + 4);
+   bool ok = 12 <= len && v->v == 4 && 20 <= a->next && a->next <= a->max && a->next <= len - 12;
+   int tail = ok ? a->next - 20 : 0;
+   expect([&] { return ok; }, Error_code::bad_message);
+   int room = size - static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map));
+   expect([&] { return tail <= room; }, Error_code::small_buffer);
+   if (!ok || room < tail) return nullptr; // the error policy didn't stop us
+   auto m = place_Obj_map(to, size, room, Zero_fixed_part{});
+   const Byte* p = from + 12; // the old flat
+   Byte* q = reinterpret_cast<Byte*>(m->flat());
+   kernels::copy_bytes(q + 0, p + 0, 20); // name, version, bytes, align
+   kernels::copy_bytes(m->tail(), p + 20, tail);
+   m->alloc.next = narrow(sizeof(Flat_map) + tail);
+   rebase_vector(q + 0, 12); // name
+   return m;
+}
+
+inline Obj_map* upgrade_Obj_map_v5_to_v6(const Byte* from, int len, Byte* to, int size)
+// the version 5 Obj_map in from[0:len) as a version 6 Obj_map in to[0:size), the rest of which is tail capacity
+// zero: fields
+{
+   auto v = reinterpret_cast<const Version*>(from + 0);
+   auto a = reinterpret_cast<const Allocator*>(from + 4);
+   bool ok = 12 <= len && v->v == 5 && 24 <= a->next && a->next <= a->max && a->next <= len - 12;
+   int tail = ok ? a->next - 24 : 0;
+   expect([&] { return ok; }, Error_code::bad_message);
+   int room = size - static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map));
+   expect([&] { return tail <= room; }, Error_code::small_buffer);
+   if (!ok || room < tail) return nullptr; // the error policy didn't stop us
+   auto m = place_Obj_map(to, size, room, Zero_fixed_part{});
+   const Byte* p = from + 12; // the old flat
+   Byte* q = reinterpret_cast<Byte*>(m->flat());
+   kernels::copy_bytes(q + 0, p + 0, 22); // name, version, bytes, align, type_id
+   kernels::copy_bytes(m->tail(), p + 24, tail);
+   m->alloc.next = narrow(sizeof(Flat_map) + tail);
+   rebase_vector(q + 0, 8); // name
+   return m;
+}
+
+inline Obj_map* upgrade_Obj_map(const Byte* from, int len, Byte* to, int size)
+// the Obj_map of any version in from[0:len) as a version 6 Obj_map in to[0:size)
+{
+   expect([&] { return 4 <= len; }, Error_code::bad_message);
+   switch (reinterpret_cast<const Version*>(from + 0)->v) {
+   case 1: return upgrade_Obj_map_v1_to_v6(from, len, to, size);
+   case 2: return upgrade_Obj_map_v2_to_v6(from, len, to, size);
+   case 3: return upgrade_Obj_map_v3_to_v6(from, len, to, size);
+   case 4: return upgrade_Obj_map_v4_to_v6(from, len, to, size);
+   case 5: return upgrade_Obj_map_v5_to_v6(from, len, to, size);
+   case 6: {
+      auto m = reinterpret_cast<const Obj_map*>(from);
+      bool ok = static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map)) <= len && m->wire_size() <= len;
+      expect([&] { return ok; }, Error_code::bad_message);
+      if (!ok) return nullptr;
+      return m->grow_into(to, size);
+   }
+   default:
+      expect([] { return false; }, Error_code::bad_version);
+      return nullptr;
+   }
+}
+
+} } // namespace Flats
+#else
+namespace Flats { inline namespace FLATS_POLICY {
+
+
+// struct (memory layout):
+struct Field_map{
+   Field_map(){}
+   std::int32_t index;
+   std::int32_t offset;
+   std::int32_t bytes;
+   std::int32_t count;
+   std::int16_t type_id;
+   String name;
+   String type_name;
+};
+
+inline bool verify(const Field_map& x, Verifier& v)
+{
+   return v.check(x.name)
+      && v.check(x.type_name);
+}
+
+
+
+// Flat direct accessors:
+// options: initializer check==0 default initialization==1
+
+   struct Field_map_message;
+struct Field_map_direct {
+   Field_map* mbuf;
+   constexpr static bool flat_tag = true;
+   Allocator* allo;
+   Field_map_direct(Field_map* pp, Allocator* a) :mbuf{pp}, allo{a} {}
+   std::int32_t& index() {  return mbuf->index; }
+   void index(std::int32_t arg) { new(&mbuf->index) std::int32_t(arg); }
+
+   std::int32_t& offset() {  return mbuf->offset; }
+   void offset(std::int32_t arg) { new(&mbuf->offset) std::int32_t(arg); }
+
+   std::int32_t& bytes() {  return mbuf->bytes; }
+   void bytes(std::int32_t arg) { new(&mbuf->bytes) std::int32_t(arg); }
+
+   std::int32_t& count() {  return mbuf->count; }
+   void count(std::int32_t arg) { new(&mbuf->count) std::int32_t(arg); }
+
+   std::int16_t& type_id() {  return mbuf->type_id; }
+   void type_id(std::int16_t arg) { new(&mbuf->type_id) std::int16_t(arg); }
+
+   Span<char> name() {  return mbuf->name; }
+   void name(const char* arg) { new(&mbuf->name) String(allo,arg); }
+   void name(const std::string&  arg) { new(&mbuf->name) String(allo,arg); }
+   void name(Extent arg) { new(&mbuf->name) String(allo,arg); }
+   void name(Push) { mbuf->name.push(allo); }
+   template<class Arg> void name(Push, Arg arg) { mbuf->name.push(allo, arg); }
+   auto name(Reserve, Extent n) { return mbuf->name.reserve(allo, n); }
+   void name(Append, std::span<const char> arg) { mbuf->name.append(allo, arg); }
+
+   Span<char> type_name() {  return mbuf->type_name; }
+   void type_name(const char* arg) { new(&mbuf->type_name) String(allo,arg); }
+   void type_name(const std::string&  arg) { new(&mbuf->type_name) String(allo,arg); }
+   void type_name(Extent arg) { new(&mbuf->type_name) String(allo,arg); }
+   void type_name(Push) { mbuf->type_name.push(allo); }
+   template<class Arg> void type_name(Push, Arg arg) { mbuf->type_name.push(allo, arg); }
+   auto type_name(Reserve, Extent n) { return mbuf->type_name.reserve(allo, n); }
+   void type_name(Append, std::span<const char> arg) { mbuf->type_name.append(allo, arg); }
+
+};
+
+class Field_map_unchecked {
+public:
+   std::int32_t& index() { return mbuf->index; }
+   std::int32_t& offset() { return mbuf->offset; }
+   std::int32_t& bytes() { return mbuf->bytes; }
+   std::int32_t& count() { return mbuf->count; }
+   std::int16_t& type_id() { return mbuf->type_id; }
+   Unchecked_span<char> name() { auto& x = mbuf->name; return {x.begin(), x.end()}; }
+   Unchecked_span<char> type_name() { auto& x = mbuf->type_name; return {x.begin(), x.end()}; }
+private:
+   Field_map_unchecked(Field_map* p) :mbuf{p} {}
+   Field_map* mbuf;
+   template<class T, class TU> friend struct Unchecked_span_ref;
+   template<class T, class TU> friend struct Unchecked_optional_ref;
+};
+
+class Field_map_batch {
+public:
+   void append(const Field_map_direct& d) {
+      auto& f = *d.mbuf;
+      cols.index.push_back(f.index);
+      cols.offset.push_back(f.offset);
+      cols.bytes.push_back(f.bytes);
+      cols.count.push_back(f.count);
+      cols.type_id.push_back(f.type_id);
+      cols.name.append(f.name.begin(), f.name.end());
+      cols.type_name.append(f.type_name.begin(), f.type_name.end());
+      ++rows;
+   }
+   std::size_t size() const { return rows; }
+   void reserve(std::size_t n) { cols.index.reserve(n); cols.offset.reserve(n); cols.bytes.reserve(n); cols.count.reserve(n); cols.type_id.reserve(n); cols.name.reserve(n); cols.type_name.reserve(n); }
+   void clear() { cols.index.clear(); cols.offset.clear(); cols.bytes.clear(); cols.count.clear(); cols.type_id.clear(); cols.name.clear(); cols.type_name.clear(); rows = 0; }
+
+   std::span<std::int32_t> index() { return cols.index; }
+   std::span<const std::int32_t> index() const { return cols.index; }
+   std::span<std::int32_t> offset() { return cols.offset; }
+   std::span<const std::int32_t> offset() const { return cols.offset; }
+   std::span<std::int32_t> bytes() { return cols.bytes; }
+   std::span<const std::int32_t> bytes() const { return cols.bytes; }
+   std::span<std::int32_t> count() { return cols.count; }
+   std::span<const std::int32_t> count() const { return cols.count; }
+   std::span<std::int16_t> type_id() { return cols.type_id; }
+   std::span<const std::int16_t> type_id() const { return cols.type_id; }
+   Ragged_column<char>& name() { return cols.name; }
+   const Ragged_column<char>& name() const { return cols.name; }
+   Ragged_column<char>& type_name() { return cols.type_name; }
+   const Ragged_column<char>& type_name() const { return cols.type_name; }
+private:
+   std::size_t rows = 0;
+   struct {
+      std::vector<std::int32_t> index;
+      std::vector<std::int32_t> offset;
+      std::vector<std::int32_t> bytes;
+      std::vector<std::int32_t> count;
+      std::vector<std::int16_t> type_id;
+      Ragged_column<char> name;
+      Ragged_column<char> type_name;
+   } cols;
+};
+
+} } // namespace Flats
+
+namespace Flats { inline namespace FLATS_POLICY {
+
+
+// struct (memory layout):
+struct Flat_map{
+   Flat_map(){}
+   String name;
+   std::int32_t version;
+   std::int32_t bytes;
+   std::int32_t align;
+   std::int16_t type_id;
+   Vector<Field_map> fields;
+};
+
+inline bool verify(const Flat_map& x, Verifier& v)
+{
+   return v.check(x.name)
+      && v.check(x.fields);
+}
+
+
+
+// Flat direct accessors:
+// options: initializer check==0 default initialization==1
+
+   struct Flat_map_message;
+struct Flat_map_direct {
+   Flat_map* mbuf;
+   constexpr static bool flat_tag = true;
+   Allocator* allo;
+   Flat_map_direct(Flat_map* pp, Allocator* a) :mbuf{pp}, allo{a} {}
+   Span<char> name() {  return mbuf->name; }
+   void name(const char* arg) { new(&mbuf->name) String(allo,arg); }
+   void name(const std::string&  arg) { new(&mbuf->name) String(allo,arg); }
+   void name(Extent arg) { new(&mbuf->name) String(allo,arg); }
+   void name(Push) { mbuf->name.push(allo); }
+   template<class Arg> void name(Push, Arg arg) { mbuf->name.push(allo, arg); }
+   auto name(Reserve, Extent n) { return mbuf->name.reserve(allo, n); }
+   void name(Append, std::span<const char> arg) { mbuf->name.append(allo, arg); }
+
+   std::int32_t& version() {  return mbuf->version; }
+   void version(std::int32_t arg) { new(&mbuf->version) std::int32_t(arg); }
+
+   std::int32_t& bytes() {  return mbuf->bytes; }
+   void bytes(std::int32_t arg) { new(&mbuf->bytes) std::int32_t(arg); }
+
+   std::int32_t& align() {  return mbuf->align; }
+   void align(std::int32_t arg) { new(&mbuf->align) std::int32_t(arg); }
+
+   std::int16_t& type_id() {  return mbuf->type_id; }
+   void type_id(std::int16_t arg) { new(&mbuf->type_id) std::int16_t(arg); }
+
+   auto fields() {  return Span_ref<Field_map, Field_map_direct>{mbuf->fields.begin(), mbuf->fields.end(), allo}; }
+   void fields(Extent arg) { new(&mbuf->fields) Vector<Field_map>(allo,arg); }
+   void fields(Push) { mbuf->fields.push(allo); }
+   template<class Arg> void fields(Push, Arg arg) { mbuf->fields.push(allo, arg); }
+
+};
+
+class Flat_map_unchecked {
+public:
+   Unchecked_span<char> name() { auto& x = mbuf->name; return {x.begin(), x.end()}; }
+   std::int32_t& version() { return mbuf->version; }
+   std::int32_t& bytes() { return mbuf->bytes; }
+   std::int32_t& align() { return mbuf->align; }
+   std::int16_t& type_id() { return mbuf->type_id; }
+   Unchecked_span_ref<Field_map, Field_map_unchecked> fields() { auto& x = mbuf->fields; return {x.begin(), x.end()}; }
+private:
+   Flat_map_unchecked(Flat_map* p) :mbuf{p} {}
+   Flat_map* mbuf;
+   friend class Obj_map_verified;
+};
+
+class Flat_map_batch {
+public:
+   void append(const Flat_map_direct& d) {
+      auto& f = *d.mbuf;
+      cols.version.push_back(f.version);
+      cols.bytes.push_back(f.bytes);
+      cols.align.push_back(f.align);
+      cols.type_id.push_back(f.type_id);
+      cols.name.append(f.name.begin(), f.name.end());
+      ++rows;
+   }
+   std::size_t size() const { return rows; }
+   void reserve(std::size_t n) { cols.version.reserve(n); cols.bytes.reserve(n); cols.align.reserve(n); cols.type_id.reserve(n); cols.name.reserve(n); }
+   void clear() { cols.version.clear(); cols.bytes.clear(); cols.align.clear(); cols.type_id.clear(); cols.name.clear(); rows = 0; }
+
+   std::span<std::int32_t> version() { return cols.version; }
+   std::span<const std::int32_t> version() const { return cols.version; }
+   std::span<std::int32_t> bytes() { return cols.bytes; }
+   std::span<const std::int32_t> bytes() const { return cols.bytes; }
+   std::span<std::int32_t> align() { return cols.align; }
+   std::span<const std::int32_t> align() const { return cols.align; }
+   std::span<std::int16_t> type_id() { return cols.type_id; }
+   std::span<const std::int16_t> type_id() const { return cols.type_id; }
+   Ragged_column<char>& name() { return cols.name; }
+   const Ragged_column<char>& name() const { return cols.name; }
+   // not in the batch: fields
+private:
+   std::size_t rows = 0;
+   struct {
+      std::vector<std::int32_t> version;
+      std::vector<std::int32_t> bytes;
+      std::vector<std::int32_t> align;
+      std::vector<std::int16_t> type_id;
+      Ragged_column<char> name;
+   } cols;
+};
+
+} } // namespace Flats
+
+namespace Flats { inline namespace FLATS_POLICY {
+static_assert(layout_width == 16, "Obj_map was generated for 16-bit Offsets and Sizes");
+struct Obj_map {
+   using Flat = Flat_map;
+   Version v = { 6}; // version is generated
+   Allocator alloc;
+   Obj_map(int buffer_size, int tail_size)
+      :alloc{ size_of<Flat>(),size_of<Flat>() + tail_size }
+      { expect([&] {return static_cast<int>(sizeof(*this)) + alloc.max <=buffer_size; }, Error_code::small_buffer);
+        kernels::zero_bytes(flat(), sizeof(Flat));
+        kernels::zero_bytes(tail(), tail_size);
+      }
+   Obj_map(Zero_fixed_part, int buffer_size, int tail_size)
+      :alloc{ size_of<Flat>(),size_of<Flat>() + tail_size }
+      { expect([&] {return static_cast<int>(sizeof(*this)) + alloc.max <=buffer_size; }, Error_code::small_buffer);
+        kernels::zero_bytes(flat(), sizeof(Flat));
+      }
+   Obj_map(Reader, int buffer_size)
+      { expect([&] {return static_cast<int>(sizeof(*this)) + alloc.next <=buffer_size && alloc.next <= alloc.max; }, Error_code::small_buffer); }
+   Byte* tail() { return reinterpret_cast<Byte*>(flat()) + sizeof(Flat); }
+   int current_size() const { return sizeof(*this) + alloc.next; }
+   int current_capacity() const { return alloc.max - alloc.next; }
+   void shrink_to_fit() { alloc.max = alloc.next; } // no more tail allocation; size() == wire_size()
+   Flat_map_direct direct() { return { flat(), &alloc }; }
+   Obj_map* grow_into(Byte* bigger, int new_size) const { // accessors to the old buffer are invalidated
+      int n = current_size();
+      expect([&] { return n <= new_size; }, Error_code::small_buffer);
+      kernels::copy_bytes(bigger, this, n);
+      kernels::zero_bytes(bigger + n, new_size - n);
+      auto p = reinterpret_cast<Obj_map*>(bigger);
+      p->alloc.max = narrow(new_size - sizeof(*this));
+      return p;
+   }
+   Flat_map* flat() { return reinterpret_cast<Flat_map*>(reinterpret_cast<Byte*>(this) + sizeof(*this)); }
+   int version() const { return v.v; }
+   int size() const { return current_size()+current_capacity(); }
+   int wire_size() const { return current_size(); } // bytes to send or copy; unused tail capacity is not included
+   Obj_map* clone(Byte* p) const {
+      kernels::copy_bytes(p, this, wire_size());
+      auto q = reinterpret_cast<Obj_map*>(p);
+      q->shrink_to_fit();
+      return q;
+   }
+   Obj_map* clone(Byte* p, Stream) const { // for large messages written into memory read elsewhere
+      kernels::stream_copy(p, this, wire_size());
+      auto q = reinterpret_cast<Obj_map*>(p);
+      q->shrink_to_fit();
+      return q;
+   }
+      Obj_map(const Obj_map& arg)
+   {
+      kernels::copy_bytes(this, &arg, arg.wire_size());
+      shrink_to_fit();
+   }
+};
+
+inline Obj_map* place_Obj_map(Byte* buf, int size_of_buffer, int size_of_tail)   { expect_aligned<Obj_map>(buf); return new(buf) Obj_map { size_of_buffer,size_of_tail }; }
+
+inline Obj_map* place_Obj_map(Byte* buf, int size_of_buffer, int size_of_tail, Zero_fixed_part z)   { expect_aligned<Obj_map>(buf); return new(buf) Obj_map { z,size_of_buffer,size_of_tail }; }
+
+inline Obj_map* place_Obj_map_reader(Byte* buf, int size_of_buffer, int )   { return new(buf) Obj_map { Reader{}, size_of_buffer}; }
+
+inline Obj_map* place_Obj_map_writer(Byte* buf, int size_of_buffer, int size_of_tail)   { expect_aligned<Obj_map>(buf); return new(buf) Obj_map { size_of_buffer,size_of_tail }; }
+
+template<class Pool> Obj_map* acquire_Obj_map(Pool& pool, int size_of_tail = 0)
+   { int n = sizeof(Obj_map) + sizeof(Flat_map) + size_of_tail; return place_Obj_map_writer(pool.acquire(n, alignof(Obj_map)), n, size_of_tail); }
+
+inline Verify_result verify_Obj_map(const Byte* buf, int len)
+// check that buf[0:len) holds a well-formed Obj_map before trusting any of it
+{
+   auto m = reinterpret_cast<const Obj_map*>(buf);
+   if (len < static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map))) return {false, Error_code::bad_message, 0};
+   if (m->v.v != 6) return {false, Error_code::bad_version, 0};
+   int next = m->alloc.next;
+   if (next < static_cast<int>(sizeof(Flat_map)) || m->alloc.max < next || len - static_cast<int>(sizeof(Obj_map)) < next)
+      return {false, Error_code::bad_message, static_cast<int>(offsetof(Obj_map, alloc))};
+   Verifier v{buf, buf + sizeof(Obj_map) + sizeof(Flat_map), buf + sizeof(Obj_map) + next};
+   verify(*reinterpret_cast<const Flat_map*>(buf + sizeof(Obj_map)), v);
+   return v.result();
+}
+
+class Obj_map_verified {
+public:
+   bool ok() const { return res.ok; }
+   Verify_result result() const { return res; }
+   Obj_map* message() const { return res.ok ? m : nullptr; }
+   Flat_map_unchecked unchecked() const
+      { expect<Error_handling::terminating>([&] { return res.ok; }, res.error); return {m->flat()}; }
+private:
+   Obj_map_verified(Obj_map* p, Verify_result r) :m{p}, res{r} {}
+   friend Obj_map_verified verified_Obj_map(Byte* buf, int len);
+   Obj_map* m;
+   Verify_result res;
+};
+
+inline Obj_map_verified verified_Obj_map(Byte* buf, int len)
+// verify_Obj_map(buf, len) once, then read through unchecked() without further checks
+   { return { reinterpret_cast<Obj_map*>(buf), verify_Obj_map(buf, len) }; }
+
+// upgrades from earlier versions of Flat_map:
+inline Obj_map* upgrade_Obj_map_v1_to_v6(const Byte* from, int len, Byte* to, int size)
+// the version 1 Obj_map in from[0:len) as a version 6 Obj_map in to[0:size), the rest of which is tail capacity
+// zero: version, bytes, align, type_id, fields
+{
+   auto v = reinterpret_cast<const Version*>(from + 0);
+   auto a = reinterpret_cast<const Allocator*>(from + 4);
+   bool ok = 8 <= len && v->v == 1 && 4 <= a->next && a->next <= a->max && a->next <= len - 8;
+   int tail = ok ? a->next - 4 : 0;
+   expect([&] { return ok; }, Error_code::bad_message);
+   int room = size - static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map));
+   expect([&] { return tail <= room; }, Error_code::small_buffer);
+   if (!ok || room < tail) return nullptr; // the error policy didn't stop us
+   auto m = place_Obj_map(to, size, room, Zero_fixed_part{});
+   const Byte* p = from + 8; // the old flat
+   Byte* q = reinterpret_cast<Byte*>(m->flat());
+   kernels::copy_bytes(q + 0, p + 0, 4); // name
+   kernels::copy_bytes(m->tail(), p + 4, tail);
+   m->alloc.next = narrow(sizeof(Flat_map) + tail);
+   rebase_vector(q + 0, 20); // name
+   return m;
+}
+
+inline Obj_map* upgrade_Obj_map_v2_to_v6(const Byte* from, int len, Byte* to, int size)
+// the version 2 Obj_map in from[0:len) as a version 6 Obj_map in to[0:size), the rest of which is tail capacity
+// zero: bytes, align, type_id, fields
+{
+   auto v = reinterpret_cast<const Version*>(from + 0);
+   auto a = reinterpret_cast<const Allocator*>(from + 4);
+   bool ok = 8 <= len && v->v == 2 && 8 <= a->next && a->next <= a->max && a->next <= len - 8;
+   int tail = ok ? a->next - 8 : 0;
+   expect([&] { return ok; }, Error_code::bad_message);
+   int room = size - static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map));
+   expect([&] { return tail <= room; }, Error_code::small_buffer);
+   if (!ok || room < tail) return nullptr; // the error policy didn't stop us
+   auto m = place_Obj_map(to, size, room, Zero_fixed_part{});
+   const Byte* p = from + 8; // the old flat
+   Byte* q = reinterpret_cast<Byte*>(m->flat());
+   kernels::copy_bytes(q + 0, p + 0, 8); // name, version
+   kernels::copy_bytes(m->tail(), p + 8, tail);
+   m->alloc.next = narrow(sizeof(Flat_map) + tail);
+   rebase_vector(q + 0, 16); // name
+   return m;
+}
+
+inline Obj_map* upgrade_Obj_map_v3_to_v6(const Byte* from, int len, Byte* to, int size)
+// the version 3 Obj_map in from[0:len) as a version 6 Obj_map in to[0:size), the rest of which is tail capacity
+// zero: align, type_id, fields
+{
+   auto v = reinterpret_cast<const Version*>(from + 0);
+   auto a = reinterpret_cast<const Allocator*>(from + 4);
+   bool ok = 8 <= len && v->v == 3 && 12 <= a->next && a->next <= a->max && a->next <= len - 8;
+   int tail = ok ? a->next - 12 : 0;
+   expect([&] { return ok; }, Error_code::bad_message);
+   int room = size - static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map));
+   expect([&] { return tail <= room; }, Error_code::small_buffer);
+   if (!ok || room < tail) return nullptr; // the error policy didn't stop us
+   auto m = place_Obj_map(to, size, room, Zero_fixed_part{});
+   const Byte* p = from + 8; // the old flat
+   Byte* q = reinterpret_cast<Byte*>(m->flat());
+   kernels::copy_bytes(q + 0, p + 0, 12); // name, version, bytes
+   kernels::copy_bytes(m->tail(), p + 12, tail);
+   m->alloc.next = narrow(sizeof(Flat_map) + tail);
+   rebase_vector(q + 0, 12); // name
+   return m;
+}
+
+inline Obj_map* upgrade_Obj_map_v4_to_v6(const Byte* from, int len, Byte* to, int size)
+// the version 4 Obj_map in from[0:len) as a version 6 Obj_map in to[0:size), the rest of which is tail capacity
+// zero: type_id, fields
+{
+   auto v = reinterpret_cast<const Version*>(from + 0);
+   auto a = reinterpret_cast<const Allocator*>(from + 4);
+   bool ok = 8 <= len && v->v == 4 && 16 <= a->next && a->next <= a->max && a->next <= len - 8;
+   int tail = ok ? a->next - 16 : 0;
+   expect([&] { return ok; }, Error_code::bad_message);
+   int room = size - static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map));
+   expect([&] { return tail <= room; }, Error_code::small_buffer);
+   if (!ok || room < tail) return nullptr; // the error policy didn't stop us
+   auto m = place_Obj_map(to, size, room, Zero_fixed_part{});
+   const Byte* p = from + 8; // the old flat
+   Byte* q = reinterpret_cast<Byte*>(m->flat());
+   kernels::copy_bytes(q + 0, p + 0, 16); // name, version, bytes, align
+   kernels::copy_bytes(m->tail(), p + 16, tail);
+   m->alloc.next = narrow(sizeof(Flat_map) + tail);
+   rebase_vector(q + 0, 8); // name
+   return m;
+}
+
+inline Obj_map* upgrade_Obj_map_v5_to_v6(const Byte* from, int len, Byte* to, int size)
+// the version 5 Obj_map in from[0:len) as a version 6 Obj_map in to[0:size), the rest of which is tail capacity
+// zero: fields
+{
+   auto v = reinterpret_cast<const Version*>(from + 0);
+   auto a = reinterpret_cast<const Allocator*>(from + 4);
+   bool ok = 8 <= len && v->v == 5 && 20 <= a->next && a->next <= a->max && a->next <= len - 8;
+   int tail = ok ? a->next - 20 : 0;
+   expect([&] { return ok; }, Error_code::bad_message);
+   int room = size - static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map));
+   expect([&] { return tail <= room; }, Error_code::small_buffer);
+   if (!ok || room < tail) return nullptr; // the error policy didn't stop us
+   auto m = place_Obj_map(to, size, room, Zero_fixed_part{});
+   const Byte* p = from + 8; // the old flat
+   Byte* q = reinterpret_cast<Byte*>(m->flat());
+   kernels::copy_bytes(q + 0, p + 0, 18); // name, version, bytes, align, type_id
+   kernels::copy_bytes(m->tail(), p + 20, tail);
+   m->alloc.next = narrow(sizeof(Flat_map) + tail);
+   rebase_vector(q + 0, 4); // name
+   return m;
+}
+
+inline Obj_map* upgrade_Obj_map(const Byte* from, int len, Byte* to, int size)
+// the Obj_map of any version in from[0:len) as a version 6 Obj_map in to[0:size)
+{
+   expect([&] { return 4 <= len; }, Error_code::bad_message);
+   switch (reinterpret_cast<const Version*>(from + 0)->v) {
+   case 1: return upgrade_Obj_map_v1_to_v6(from, len, to, size);
+   case 2: return upgrade_Obj_map_v2_to_v6(from, len, to, size);
+   case 3: return upgrade_Obj_map_v3_to_v6(from, len, to, size);
+   case 4: return upgrade_Obj_map_v4_to_v6(from, len, to, size);
+   case 5: return upgrade_Obj_map_v5_to_v6(from, len, to, size);
+   case 6: {
+      auto m = reinterpret_cast<const Obj_map*>(from);
+      bool ok = static_cast<int>(sizeof(Obj_map) + sizeof(Flat_map)) <= len && m->wire_size() <= len;
+      expect([&] { return ok; }, Error_code::bad_message);
+      if (!ok) return nullptr;
+      return m->grow_into(to, size);
+   }
+   default:
+      expect([] { return false; }, Error_code::bad_version);
+      return nullptr;
+   }
+}
+
+} } // namespace Flats
+#endif
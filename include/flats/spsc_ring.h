@@ -0,0 +1,328 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0.
+
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+#pragma once
+/*
+	Spsc_ring: a single-producer single-consumer ring of variable-size records in shared memory (POSIX)
+
+	Messages are placed directly in the ring and read where they are: no copies.
+	A record is a small header followed by contiguous bytes, so a record never wraps around the end of the ring;
+	when a record doesn't fit before the end, the writer leaves a skip marker and starts over at the beginning.
+
+	Writer:
+		Byte* p = ring.reserve(n);	// nullptr if the ring is full; try again later
+		auto m = place_M_writer(p, n, n - sizeof(M) - sizeof(M::Flat));	// or place_M(..., Zero_fixed_part{})
+		// ... fill m ...
+		ring.commit(m->wire_size());	// publishes with a release store; the rest of the n bytes are given back
+
+	Reader:
+		auto r = ring.front();	// empty if there is nothing to read
+		auto m = place_M_reader(r.data(), r.size(), 0);	// the reader needs only wire_size() bytes
+		// ... use m ...
+		ring.pop();	// hands the space back to the writer
+
+	The ring lives in a shared memory object:
+		create(name, capacity) and open(name) use shm_open()
+		anonymous(capacity) uses memfd_create(); share it with fork() or by passing fd()
+	capacity is rounded up to a power of two; a record can use at most half of it.
+	If the shared memory can't be set up and the error policy doesn't stop us, the ring is left unmapped:
+	capacity() is 0, reserve() returns nullptr, and front() is empty.
+	Every record, and so every message, is aligned to the ring's alignment: by default alignof(std::max_align_t),
+	at most a cache line; give 64 for messages of flats with "align 64".
+
+	Restrictions:
+		one writing thread and one reading thread (in the same or different processes)
+		writer and reader must agree on the message types; nothing is checked
+*/
+
+#include "flat_types.h"
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Flats
+{
+inline namespace FLATS_POLICY
+{
+
+class Spsc_ring
+{
+public:
+  static constexpr int max_align = 64; // the records start at a multiple of 64 in the mapping
+
+  static Spsc_ring create(const char* name, std::size_t capacity, int alignment = alignof(std::max_align_t))
+  // a new ring in the POSIX shared memory object called name
+  {
+    int fd = ::shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    expect([&] { return fd != -1; }, Error_code::shared_memory);
+    return Spsc_ring{fd, capacity, alignment};
+  }
+
+  static Spsc_ring open(const char* name)
+  // a ring made by create(name, ...), for the other end
+  {
+    int fd = ::shm_open(name, O_RDWR, 0);
+    expect([&] { return fd != -1; }, Error_code::shared_memory);
+    return Spsc_ring{fd};
+  }
+
+  static void unlink(const char* name)
+  // remove the name; the memory goes when the last mapping does
+  {
+    ::shm_unlink(name);
+  }
+
+  static Spsc_ring anonymous(std::size_t capacity, int alignment = alignof(std::max_align_t))
+  // a ring with no name: it can be shared by fork() or by passing fd() to another process
+  {
+    int fd = ::memfd_create("flats_spsc_ring", 0);
+    expect([&] { return fd != -1; }, Error_code::shared_memory);
+    return Spsc_ring{fd, capacity, alignment};
+  }
+
+  explicit Spsc_ring(int fd)
+  // map an existing ring; takes ownership of fd
+    : file{fd}
+  {
+    struct stat st;
+    bool ok = ::fstat(fd, &st) == 0 && sizeof(Control) < static_cast<std::size_t>(st.st_size);
+    expect([&] { return ok; }, Error_code::shared_memory);
+    if (!ok || !map(st.st_size))
+      return; // the error policy didn't stop us
+    ok = ctl->magic == magic && sizeof(Control) + ctl->capacity == bytes && good_align(ctl->align);
+    expect([&] { return ok; }, Error_code::shared_memory);
+    if (!ok)
+    {
+      unmap(); // the error policy didn't stop us
+      return;
+    }
+    mask = ctl->capacity - 1;
+    align = ctl->align;
+    data = reinterpret_cast<Byte*>(ctl + 1);
+    head = head_seen = ctl->head.load(std::memory_order_acquire);
+    tail = tail_seen = ctl->tail.load(std::memory_order_acquire);
+  }
+
+  Spsc_ring(Spsc_ring&& r) noexcept
+  {
+    swap(r);
+  }
+
+  Spsc_ring& operator=(Spsc_ring&& r) noexcept
+  {
+    swap(r);
+    return *this;
+  }
+
+  ~Spsc_ring()
+  {
+    if (ctl)
+      ::munmap(ctl, bytes);
+    if (file != -1)
+      ::close(file);
+  }
+
+  int fd() const
+  {
+    return file;
+  }
+
+  std::size_t capacity() const
+  {
+    return ctl ? mask + 1 : 0;
+  }
+
+  int alignment() const
+  {
+    return static_cast<int>(align);
+  }
+
+  // writer:
+
+  Byte* reserve(int n)
+  // n contiguous bytes for the next record, or nullptr if the ring is too full
+  {
+    if (!ctl)
+      return nullptr; // unmapped
+    std::size_t need = record_size(n);
+    expect([&] { return 2 * need <= capacity(); }, Error_code::small_buffer);
+    std::size_t to_end = capacity() - (head & mask);
+    std::size_t at = (to_end < need) ? head + to_end : head; // skip to the beginning
+    if (capacity() < at + need - tail_seen)
+    {
+      tail_seen = ctl->tail.load(std::memory_order_acquire);
+      if (capacity() < at + need - tail_seen)
+        return nullptr;
+    }
+    if (at != head)
+      record(head)->size = skip;
+    reserved = at;
+    room = n;
+    return payload(at);
+  }
+
+  void commit(int n)
+  // publish the first n bytes of the space obtained from the latest reserve()
+  {
+    expect([&] { return 0 <= n && n <= room; }, Error_code::small_buffer);
+    if (n < 0 || room < n)
+      return; // the error policy didn't stop us
+    room = -1;
+    record(reserved)->size = n;
+    head = reserved + record_size(n);
+    ctl->head.store(head, std::memory_order_release);
+  }
+
+  // reader:
+
+  std::span<Byte> front()
+  // the oldest record, or an empty span if there is none
+  {
+    if (!ctl)
+      return {}; // unmapped
+    if (tail == head_seen)
+    {
+      head_seen = ctl->head.load(std::memory_order_acquire);
+      if (tail == head_seen)
+        return {};
+    }
+    if (record(tail)->size == skip)
+      tail += capacity() - (tail & mask);
+    return {payload(tail), static_cast<std::size_t>(record(tail)->size)};
+  }
+
+  void pop()
+  // done with the record from front()
+  {
+    tail += record_size(record(tail)->size);
+    ctl->tail.store(tail, std::memory_order_release);
+  }
+
+private:
+  static constexpr std::uint64_t magic = 0x676e69725f737466; // "fts_ring"
+  static constexpr std::int32_t skip = -1; // no record from here to the end of the ring
+
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "Spsc_ring needs lock-free 64-bit atomics");
+
+  struct Control
+  { // the beginning of the shared memory; the records follow
+    std::uint64_t magic;
+    std::uint64_t capacity; // a power of two
+    std::uint64_t align; // of every record; a record's header takes align bytes
+    alignas(64) std::atomic<std::uint64_t> head; // bytes ever written; only the writer stores
+    alignas(64) std::atomic<std::uint64_t> tail; // bytes ever read; only the reader stores
+  };
+  static_assert(sizeof(Control) % max_align == 0, "the records must start on a cache line");
+
+  struct Record
+  { // followed by padding to align
+    std::int32_t size; // of the payload, or skip
+  };
+
+  static bool good_align(std::uint64_t a)
+  {
+    return alignof(std::max_align_t) <= a && a <= max_align && std::has_single_bit(a);
+  }
+
+  Spsc_ring(int fd, std::size_t cap, int alignment)
+  // initialize a new ring in fd; takes ownership of fd
+    : file{fd}
+  {
+    expect([&] { return good_align(alignment); }, Error_code::bad_int);
+    align = good_align(alignment) ? alignment : alignof(std::max_align_t);
+    cap = std::bit_ceil((cap < 2 * align) ? 2 * align : cap);
+    bool ok = ::ftruncate(fd, sizeof(Control) + cap) == 0;
+    expect([&] { return ok; }, Error_code::shared_memory);
+    if (!ok || !map(sizeof(Control) + cap))
+      return; // the error policy didn't stop us
+    new (ctl) Control{magic, cap, align, {0}, {0}};
+    mask = cap - 1;
+    data = reinterpret_cast<Byte*>(ctl + 1);
+  }
+
+  bool map(std::size_t n)
+  // false if the mapping failed; the ring stays unmapped
+  {
+    void* p = ::mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    expect([&] { return p != MAP_FAILED; }, Error_code::shared_memory);
+    if (p == MAP_FAILED)
+      return false; // the error policy didn't stop us
+    ctl = static_cast<Control*>(p);
+    bytes = n;
+    return true;
+  }
+
+  void unmap()
+  {
+    ::munmap(ctl, bytes);
+    ctl = nullptr;
+    bytes = 0;
+  }
+
+  void swap(Spsc_ring& r) noexcept
+  {
+    std::swap(file, r.file);
+    std::swap(ctl, r.ctl);
+    std::swap(bytes, r.bytes);
+    std::swap(data, r.data);
+    std::swap(mask, r.mask);
+    std::swap(align, r.align);
+    std::swap(head, r.head);
+    std::swap(tail_seen, r.tail_seen);
+    std::swap(reserved, r.reserved);
+    std::swap(room, r.room);
+    std::swap(tail, r.tail);
+    std::swap(head_seen, r.head_seen);
+  }
+
+  std::size_t record_size(int n) const
+  {
+    return (align + n + align - 1) & ~(align - 1);
+  }
+
+  Record* record(std::uint64_t pos) const
+  {
+    return reinterpret_cast<Record*>(data + (pos & mask));
+  }
+
+  Byte* payload(std::uint64_t pos) const
+  {
+    return data + (pos & mask) + align;
+  }
+
+  int file = -1;
+  Control* ctl = nullptr;
+  std::size_t bytes = 0; // mapped
+  Byte* data = nullptr;
+  std::size_t mask = 0;
+  std::size_t align = alignof(std::max_align_t); // of every record
+
+  // private to each end, to keep the writer and reader off each other's cache lines:
+  std::uint64_t head = 0; // writer: our copy of ctl->head
+  std::uint64_t tail_seen = 0; // writer: ctl->tail when we last looked
+  std::uint64_t reserved = 0; // writer: position of the reserved record
+  int room = -1; // writer: bytes obtained by the latest reserve(); -1 once committed
+  std::uint64_t tail = 0; // reader: our copy of ctl->tail
+  std::uint64_t head_seen = 0; // reader: ctl->head when we last looked
+};
+
+} // inline namespace FLATS_POLICY
+} // namespace Flats
@@ -0,0 +1,96 @@
+/*
+  Morgan Stanley makes this available to you under the Apache License,
+  Version 2.0 (the "License"). You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0.
+
+  See the NOTICE file distributed with this work for additional information
+  regarding copyright ownership. Unless required by applicable law or agreed
+  to in writing, software distributed under the License is distributed on an
+  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+  or implied. See the License for the specific language governing permissions
+  and limitations under the License.
+*/
+
+#pragma once
+/*
+	Offset tables for view accessors: where each field of a flat is in a given version of the flat
+
+	A view reads a flat through a table of offsets, indexed by the field's index (which is stable over versions),
+	so a reader can read messages written with another version of the schema without translation:
+	a field access is a load of the offset from the table and a load of the field.
+	A field that is not in the writer's version has offset -1 (see has_x() in the generated views).
+
+	The generated view headers ("flats view") register the tables of the schema they were generated from.
+	To read messages written with another version, also #include the tables of that version:
+		flats offsets old_schema.flat old_offsets.h
+	(or add() them, e.g., from an object map read at run time).
+
+	Tables are registered once and never change or go away, so a view can keep a pointer to its table.
+	A reader's version may have more fields than the writer's: find() widens the table with -1s as needed.
+	Looking a table up takes a lock; the generated <Flat>_offsets(version) remembers the last table each thread used.
+	The registry doesn't know whether a message was packed: don't mix packed and unpacked messages of a flat.
+*/
+
+#include "flat_types.h"
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Flats
+{
+
+class Offset_registry
+// process-wide: (flat, version) -> offsets by field index
+{
+public:
+  static Offset_registry& get()
+  {
+    static Offset_registry r;
+    return r;
+  }
+
+  const int* add(const std::string& flat, int version, std::vector<int> offsets)
+  // register a table; if (flat, version) already has one, that one is kept and returned
+  {
+    std::unique_lock<std::shared_mutex> lock{mtx};
+    auto [p, inserted] = tables.try_emplace({flat, version}, std::move(offsets));
+    return p->second.data();
+  }
+
+  const int* find(const std::string& flat, int version, int fields)
+  // the table for (flat, version) with at least fields entries, the ones beyond that version's fields being -1
+  // nullptr if (flat, version) has no table
+  {
+    {
+      std::shared_lock<std::shared_mutex> lock{mtx};
+      auto p = tables.find({flat, version});
+      if (p == tables.end())
+        return nullptr;
+      if (fields <= static_cast<int>(p->second.size()))
+        return p->second.data();
+    }
+    std::unique_lock<std::shared_mutex> lock{mtx};
+    auto& t = tables[{flat, version}];
+    if (static_cast<int>(t.size()) < fields)
+    { // a reader that knows more fields than the writer did; keep the old table for the views using it
+      std::vector<int> wider = t;
+      wider.resize(fields, -1);
+      retired.push_back(std::move(t));
+      t = std::move(wider);
+    }
+    return t.data();
+  }
+
+private:
+  Offset_registry() = default;
+
+  std::shared_mutex mtx;
+  std::map<std::pair<std::string, int>, std::vector<int>> tables;
+  std::vector<std::vector<int>> retired; // moving a vector keeps its elements in place
+};
+
+} // namespace Flats